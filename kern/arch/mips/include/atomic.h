@@ -0,0 +1,89 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Machine-dependent atomic primitives, using LL/SC. Everything else
+ * in <atomic.h> is built on these two.
+ */
+
+int atomic_fetchadd(volatile int *p, int delta);
+bool atomic_cas(volatile int *p, int oldval, int newval);
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Add DELTA to *P and return the value *P had before.
+ */
+ATOMIC_INLINE
+int
+atomic_fetchadd(volatile int *p, int delta)
+{
+	int x;
+	int y;
+
+	/*
+	 * Load the existing value into X, and store X+DELTA via Y.
+	 * After the SC, Y contains 1 if the store succeeded, 0 if
+	 * someone else got in between, in which case we go around
+	 * again.
+	 */
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/*
+ * If *P is OLDVAL, set it to NEWVAL and return true; otherwise leave
+ * it alone and return false.
+ */
+ATOMIC_INLINE
+bool
+atomic_cas(volatile int *p, int oldval, int newval)
+{
+	int x;
+	int y;
+
+	/*
+	 * Load the existing value into X. If it isn't OLDVAL, skip
+	 * the store, leaving Y at 0. Otherwise try to store NEWVAL
+	 * via Y, which afterwards says whether the SC succeeded.
+	 * (The assembler fills the branch delay slot.)
+	 *
+	 * A failed SC doesn't necessarily mean *P changed, so retry
+	 * until we either store or see a different value.
+	 */
+
+	do {
+		y = 0;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != oldval) fail */
+			"move %1, %4;"		/*   y = newval */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (p), "r" (oldval), "r" (newval)
+			: "memory");
+		if (x != oldval) {
+			return false;
+		}
+	} while (y == 0);
+	return true;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
@@ -194,6 +195,20 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+#if OPT_A2
+		/*
+		 * A user thread that never traps for anything else
+		 * still takes clock interrupts, so check here too
+		 * whether its process is exiting. Leaving may sleep,
+		 * so put the interrupt state back as for a trap first.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			uthread_checkexit();
+		}
+#endif
 		goto done2;
 	}
 
@@ -314,6 +329,13 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_A2
+	/* Don't go back to user mode if another thread called _exit. */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+#endif
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -108,6 +108,22 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS___futex_wait:
+		err = sys___futex_wait((userptr_t)tf->tf_a0,
+				       (int)tf->tf_a1);
+		break;
+
+	    case SYS___futex_wake:
+		err = sys___futex_wake((userptr_t)tf->tf_a0,
+				       (int)tf->tf_a1,
+				       &retval);
+		break;
 #ifdef UW
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
@@ -134,10 +150,39 @@ syscall(struct trapframe *tf)
 	  err = sys_fork(tf, (pid_t *)&retval);
 	  break;
 
+	case SYS_vfork:
+	  err = sys_vfork(tf, (pid_t *)&retval);
+	  break;
+
+	case SYS___spawn:
+	  err = sys___spawn((userptr_t)tf->tf_a0,
+			    (userptr_t)tf->tf_a1,
+			    (userptr_t)tf->tf_a2,
+			    (int)tf->tf_a3,
+			    (pid_t *)&retval);
+	  break;
+
 	case SYS_execv:
 	  err = sys_execv(tf, (int *)&retval);
 	  break;
 
+	case SYS___thread_create:
+	  err = sys___thread_create(tf,
+				    (userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1,
+				    (userptr_t)tf->tf_a2,
+				    (int *)&retval);
+	  break;
+	case SYS___thread_exit:
+	  sys___thread_exit((int)tf->tf_a0);
+	  /* sys___thread_exit does not return */
+	  panic("unexpected return from sys___thread_exit");
+	  break;
+	case SYS___thread_join:
+	  err = sys___thread_join((int)tf->tf_a0,
+				  (userptr_t)tf->tf_a1);
+	  break;
+
 	#endif
 #endif // UW
 
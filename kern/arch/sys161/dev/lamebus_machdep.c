@@ -73,6 +73,22 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Set c0_count. Used with mips_timer_set to start a fresh period.
+ */
+static
+void
+mips_timer_setcount(uint32_t count)
+{
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		:: "r" (count));
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -242,6 +258,32 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Make the next on-chip timer interrupt come TICKS periods from now.
+ * (The interrupt handler puts it back to HZ afterwards.)
+ *
+ * The timer interrupt handler relies on System/161 resetting c0_count
+ * to 0 when it matches c0_compare, so that writing the period to
+ * c0_compare means "one period from now". When we get here, though,
+ * count can be anywhere: part way into a period, or (when a tickless
+ * sleep is cut short by an IPI) already past the compare value we're
+ * about to write, which would then not match until count wrapped
+ * around, minutes later. So start count over from 0 as well.
+ */
+void
+mainbus_set_hardclock(unsigned ticks)
+{
+	const unsigned maxticks = 0xffffffffU / (CPU_FREQUENCY / HZ);
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(ticks > 0);
+	if (ticks > maxticks) {
+		ticks = maxticks;
+	}
+	mips_timer_setcount(0);
+	mips_timer_set(ticks * (CPU_FREQUENCY / HZ));
+}
+
 /*
  * Interrupt dispatcher.
  */
@@ -294,6 +294,8 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	if (lh->lh_clear == NULL) {
 		return ENOMEM;
 	}
+	/* Serve disk requests in arrival order so none can starve. */
+	sem_setfifo(lh->lh_clear, true);
 	lh->lh_done = sem_create("lhd-done", 0);
 	if (lh->lh_done == NULL) {
 		sem_destroy(lh->lh_clear);
@@ -38,6 +38,7 @@
 #include <stat.h>
 #include <lib.h>
 #include <array.h>
+#include <atomic.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <synch.h>
@@ -904,7 +905,7 @@ sfs_reclaim(struct vnode *v)
 
 		/* consume the reference VOP_DECREF gave us */
 		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+		atomic_dec(&v->vn_refcount);
 
 		vfs_biglock_release();
 		return EBUSY;
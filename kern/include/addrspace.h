@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include <workqueue.h>
 #include "opt-A3.h"
 
 struct vnode;
@@ -68,6 +69,8 @@ struct addrspace {
   
   bool is_loading;
 
+  struct work as_exitwork;   /* for destroying it off the exit path */
+
   // p base 1 and 2
 };
 
@@ -81,6 +84,7 @@ struct addrspace {
   paddr_t as_pbase2;
   size_t as_npages2;
   paddr_t as_stackpbase;
+  struct work as_exitwork;   /* for destroying it off the exit path */
 };
 #endif
 
@@ -0,0 +1,45 @@
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Program arguments on their way to a new user stack.
+ *
+ * The strings are packed back to back into one ARG_MAX buffer as
+ * they are copied in. argbuf_copyout then puts the argv pointers in
+ * front of them and writes the lot to the new stack with a single
+ * copyout. The strings, their pointers and the NULL after them must
+ * fit in ARG_MAX together, or the copy-in fails with E2BIG.
+ *
+ * An ARG_MAX buffer is too big to kmalloc cheaply every time (and
+ * without A3 it is never given back), so released buffers are kept
+ * for the next exec.
+ */
+
+struct argbuf {
+	char *ab_data;		/* ARG_MAX bytes, or NULL */
+	size_t ab_len;		/* Bytes of strings so far */
+	int ab_argc;
+};
+
+/* Get a buffer; ENOMEM if there isn't one. */
+int argbuf_init(struct argbuf *ab);
+/* Give it back. Does nothing if there's no buffer. */
+void argbuf_cleanup(struct argbuf *ab);
+
+/*
+ * Fill the buffer from the user argv array at UARGV, or from NARGS
+ * kernel strings ARGS. EFAULT if UARGV or a string in it is bad;
+ * E2BIG if it all doesn't fit.
+ */
+int argbuf_copyin(struct argbuf *ab, userptr_t uargv);
+int argbuf_set(struct argbuf *ab, char **args, int nargs);
+
+/*
+ * Write the arguments below *STACKPTR in the current address space.
+ * Updates *STACKPTR and returns the user address of argv in *ARGV.
+ * E2BIG if the stack is too small for them. After this the buffer is
+ * only good for argbuf_cleanup.
+ */
+int argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv);
+
+#endif /* _ARGBUF_H_ */
@@ -0,0 +1,64 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on ints.
+ *
+ * These are for counters and flags that are updated from several
+ * cpus at once but aren't worth a lock of their own. They do not
+ * disable interrupts, so they are safe to use from interrupt
+ * handlers too.
+ *
+ * atomic_fetchadd and atomic_cas are machine-dependent; the rest are
+ * built on them here.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+void atomic_inc(volatile int *p);
+void atomic_dec(volatile int *p);
+bool atomic_inc_and_test(volatile int *p);
+bool atomic_dec_and_test(volatile int *p);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+void
+atomic_inc(volatile int *p)
+{
+	atomic_fetchadd(p, 1);
+}
+
+ATOMIC_INLINE
+void
+atomic_dec(volatile int *p)
+{
+	atomic_fetchadd(p, -1);
+}
+
+/*
+ * Increment or decrement *P, and return true if the result is 0.
+ */
+ATOMIC_INLINE
+bool
+atomic_inc_and_test(volatile int *p)
+{
+	return atomic_fetchadd(p, 1) == -1;
+}
+
+ATOMIC_INLINE
+bool
+atomic_dec_and_test(volatile int *p)
+{
+	return atomic_fetchadd(p, -1) == 1;
+}
+
+#endif /* _ATOMIC_H_ */
@@ -0,0 +1,86 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions run at a given point in the future.
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timing wheel
+ * that hardclock() advances by one slot per tick. callout_schedule
+ * puts a callout on the current cpu's wheel, to run that many
+ * hardclocks from now; callout_schedule_ns converts from nanoseconds,
+ * rounding up.
+ *
+ * The function runs on the cpu it was scheduled on, from hardclock,
+ * in interrupt context: it must not sleep, though it may take
+ * spinlocks and wake threads up.
+ *
+ * The struct callout belongs to the caller, who typically embeds it
+ * in something else; there is no allocation. Scheduling a callout
+ * that is already pending reschedules it. The caller must not
+ * schedule or cancel the same callout from two places at once
+ * (other than its own function rescheduling it).
+ *
+ * callout_cancel stops a pending callout and returns true, or returns
+ * false if it wasn't pending. If the function is running on another
+ * cpu, it waits for it to finish, so afterwards the callout can be
+ * freed. It must not be called from the callout's own function, or
+ * while holding a spinlock the function takes.
+ */
+
+#include <spinlock.h>
+
+/*
+ * Wheel geometry: CALLOUT_LEVELS levels of 2^CALLOUT_SLOTBITS slots.
+ * Level N slots each cover 2^(N*CALLOUT_SLOTBITS) ticks. Callouts
+ * beyond the reach of the top level wait in its last slot and are
+ * rehashed each time it comes around.
+ */
+#define CALLOUT_SLOTBITS	6
+#define CALLOUT_SLOTS		(1 << CALLOUT_SLOTBITS)
+#define CALLOUT_LEVELS		4
+
+struct cpu;
+
+struct callout {
+	struct callout *co_next;	/* Link in slot or expired list */
+	struct callout **co_prevp;	/* Whatever points to us */
+	uint64_t co_expire;		/* Wheel time (in ticks) to run at */
+	void (*co_func)(void *);	/* Function to run... */
+	void *co_arg;			/* ...and its argument */
+	struct cpu *volatile co_cpu;	/* Wheel it was last scheduled on */
+	volatile bool co_pending;	/* On that wheel, waiting to run */
+};
+
+struct callout_wheel {
+	struct spinlock cw_lock;
+	uint64_t cw_now;		/* Ticks since the wheel started */
+	struct callout *cw_slots[CALLOUT_LEVELS][CALLOUT_SLOTS];
+	struct callout *cw_expired;	/* Due; being run by hardclock */
+	struct callout *volatile cw_running; /* Function now running */
+};
+
+/* Set up or tear down a callout. */
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_cleanup(struct callout *co);
+
+/* Run it in TICKS hardclocks (or NSECS nanoseconds) on this cpu. */
+void callout_schedule(struct callout *co, unsigned ticks);
+void callout_schedule_ns(struct callout *co, uint64_t nsecs);
+
+/* Stop it if it hasn't run. */
+bool callout_cancel(struct callout *co);
+
+/* True if it is waiting to run. */
+bool callout_pending(struct callout *co);
+
+/* Per-cpu wheel setup, and the hook called from hardclock. */
+void callout_wheel_init(struct callout_wheel *cw);
+void callout_hardclock(void);
+
+/*
+ * How many hardclocks this cpu can go without before its wheel needs
+ * to advance (at least 1). Used to skip ticks while idle.
+ */
+unsigned callout_idleticks(void);
+
+#endif /* _CALLOUT_H_ */
@@ -35,8 +35,9 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for
+ * scheduling and callouts; an idle CPU skips it until its next
+ * callout is due.
  *
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -61,8 +62,24 @@ void hardclock_bootstrap(void);
 void hardclock(void);
 void timerclock(void);
 
+/*
+ * Tickless idle support. The idle loop calls hardclock_idle before
+ * idling, so hardclocks that would have nothing to do are skipped, and
+ * hardclock_unidle when it wakes up. hardclock_anytickless says if any
+ * cpu is currently skipping hardclocks. None are skipped until
+ * hardclock_tickless_bootstrap is called, after the clock used by
+ * gettime() is configured.
+ */
+void hardclock_tickless_bootstrap(void);
+void hardclock_idle(void);
+void hardclock_unidle(void);
+bool hardclock_anytickless(void);
+
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
+/* gettime() as a single count of nanoseconds. */
+uint64_t clock_nsecs(void);
+
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
@@ -73,5 +90,19 @@ void getinterval(time_t secs1, uint32_t nsecs,
  */
 void clocksleep(int seconds);
 
+/*
+ * clocksleep_ns() suspends execution for at least the requested number
+ * of nanoseconds, to the resolution of hardclock.
+ */
+void clocksleep_ns(uint64_t nsecs);
+
+/*
+ * The same, but it gives up early, returning EINTR, once *STOP is
+ * true. Whoever sets *STOP then calls clocksleep_interrupt so the
+ * sleeper notices.
+ */
+int clocksleep_ns_intr(uint64_t nsecs, volatile bool *stop);
+void clocksleep_interrupt(void);
+
 
 #endif /* _CLOCK_H_ */
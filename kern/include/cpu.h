@@ -33,9 +33,41 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <callout.h>
+#include <schedstat.h>
+#include <splstat.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of free kernel stacks each cpu keeps around for reuse by
+ * thread_fork. Stacks beyond this are handed back to kfree.
+ */
+#define CPU_STACKCACHE_SIZE	16
+
+/*
+ * Scheduler tuning.
+ *
+ * Each cpu has SCHED_NLEVELS run queues, one per priority level;
+ * level 0 is the highest priority. A thread at level L may run for
+ * SCHED_QUANTUM(L) hardclocks before it is preempted and demoted one
+ * level. A thread that goes to sleep before using up its quantum is
+ * promoted one level.
+ */
+#define SCHED_NLEVELS		4
+#define SCHED_QUANTUM_BASE	1	/* Quantum at level 0, in hardclocks */
+#define SCHED_QUANTUM(level)	(SCHED_QUANTUM_BASE << (level))
+
+/*
+ * Affinity tuning. A thread that ran on a cpu less than
+ * SCHED_CACHEHOT_HARDCLOCKS ago is assumed to still have its working
+ * set in that cpu's cache and is not migrated if something else can
+ * be. A woken thread goes back to the cpu it last ran on if that cpu
+ * is idle or has at most SCHED_AFFINITY_LOAD threads waiting.
+ */
+#define SCHED_CACHEHOT_HARDCLOCKS	2
+#define SCHED_AFFINITY_LOAD		1
+
 /*
  * Per-cpu structure
  *
@@ -60,15 +92,37 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	void *c_stackcache[CPU_STACKCACHE_SIZE]; /* Free kernel stacks */
+	unsigned c_numstackcache;	/* Number of entries in c_stackcache */
+	uint32_t c_stealseed;		/* Random state for picking victims */
+	unsigned c_affinity_hits;	/* Wakeups sent back to their last cpu */
+	unsigned c_migrations;		/* Threads this cpu moved between cpus */
+	struct thread *c_parkthread;	/* Runs while cpu is out of use */
+	bool c_tickless;		/* Idle with hardclock deferred */
+	uint64_t c_tickless_start;	/* When that began, in ns */
+#if OPT_SCHEDSTAT
+	struct schedstat c_schedstat;	/* Latency statistics */
+#endif
+#if OPT_SPLSTAT
+	uint64_t c_irqoff_start;	/* When interrupts went off, or 0 */
+	uint64_t c_irqoff_idle;		/* Time idle since then */
+	const void *c_irqoff_site;	/* Who turned them off */
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by priority */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus.
+	 * Protected by its own lock (cw_lock).
+	 */
+	struct callout_wheel c_callouts; /* Pending callouts */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -0,0 +1,26 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes: wait queues for user-level synchronization.
+ *
+ * A futex is a word in user memory. __futex_wait sleeps if the word
+ * still holds the value the caller expects, and __futex_wake wakes
+ * up to some number of threads sleeping on it. User code does the
+ * actual locking with atomic operations on the word and only calls
+ * into the kernel when it has to wait or has someone to wake.
+ *
+ * Waiters are kept in a hash table of queues keyed by address space
+ * and user address, each with its own wait channel. Queues only exist
+ * while somebody is waiting on them.
+ *
+ * futex_exiting wakes every thread waiting on any futex in AS, for
+ * use when a process is going away.
+ */
+
+struct addrspace;
+
+void futex_bootstrap(void);
+void futex_exiting(struct addrspace *as);
+
+#endif /* _FUTEX_H_ */
@@ -0,0 +1,25 @@
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * Definitions for __spawn().
+ *
+ * File actions are done in the new process, in order, before the
+ * program starts. SPAWN_CLOSE closes sa_fd, as close(sa_fd) would;
+ * SPAWN_DUP2 does dup2(sa_fd, sa_newfd). If one fails, __spawn fails
+ * with its error and no process is created.
+ */
+
+#define SPAWN_CLOSE	1
+#define SPAWN_DUP2	2
+
+struct spawn_action {
+	int sa_op;		/* SPAWN_CLOSE or SPAWN_DUP2 */
+	int sa_fd;
+	int sa_newfd;		/* SPAWN_DUP2 only */
+};
+
+/* Most file actions one __spawn call can take. */
+#define SPAWN_ACTIONS_MAX	16
+
+#endif /* _KERN_SPAWN_H_ */
@@ -197,6 +197,16 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Threads --
+#define SYS___thread_create 121
+#define SYS___thread_exit   122
+#define SYS___thread_join   123
+#define SYS___futex_wait    124
+#define SYS___futex_wake    125
+
+//                              -- Process creation --
+#define SYS___spawn         126
+
 /*CALLEND*/
 
 
@@ -0,0 +1,54 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With the lockstat kernel option, every spinlock, lock and semaphore
+ * acquisition is counted against an entry keyed by the lock's name
+ * and the address the acquire was called from. Each entry records
+ * acquisitions, how many had to wait, total and max wait time, and
+ * (for spinlocks and locks) total and max hold time.
+ *
+ * Spinlocks don't have names, so all spinlocks taken from the same
+ * call site share one entry.
+ *
+ * Nothing is recorded until lockstat_bootstrap is called, which must
+ * be after the clock used by gettime() has been configured.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct lockstat;	/* Opaque */
+
+/* Name used for all spinlock entries. */
+#define LOCKSTAT_SPINLOCK	"(spinlock)"
+
+void lockstat_bootstrap(void);
+
+/*
+ * lockstat_now returns a timestamp to pass to lockstat_acquired, or 0
+ * if statistics aren't being collected yet.
+ *
+ * lockstat_acquired records an acquisition that started waiting at
+ * WAITSTART. It returns the entry to charge the hold time to (or
+ * NULL) and stores the time the lock was obtained in *ACQTIME.
+ *
+ * lockstat_released charges the time since ACQTIME to entry LS,
+ * which may be NULL.
+ */
+uint64_t lockstat_now(void);
+struct lockstat *lockstat_acquired(const char *name, const void *callsite,
+				   bool contended, uint64_t waitstart,
+				   uint64_t *acqtime);
+void lockstat_released(struct lockstat *ls, uint64_t acqtime);
+
+/* Print the statistics, sorted by total wait time; or clear them. */
+void lockstat_print(void);
+void lockstat_reset(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,14 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Make the current cpu's next hardclock come TICKS hardclock periods
+ * from now rather than one. Periodic ticks resume after it goes off,
+ * or when called again with TICKS of 1. TICKS may be clamped to what
+ * the timer can count.
+ */
+void mainbus_set_hardclock(unsigned ticks);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
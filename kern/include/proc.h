@@ -42,6 +42,7 @@
 
 struct addrspace;
 struct vnode;
+struct wchan;
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -71,39 +72,111 @@ struct proc {
 
 #if OPT_A2
     struct proc_info *info;
+
+	/* User-level threads; see thread_syscalls.c. Protected by p_lock. */
+	struct uthread *p_uthreads;	/* Exit records of created threads */
+	int p_nexttid;			/* Next thread id to hand out */
+	struct wchan *p_joinwchan;	/* Threads waiting in __thread_join */
+	bool p_exiting;			/* _exit called; all threads must go */
+	int p_exitcode;			/* ...with this exit code */
+
+	uint32_t p_openfds;		/* Open descriptors; see PROC_NFDS */
+	uint32_t p_wrfds;		/* ...and the ones open for writing */
+
+	/* vfork; see fork_common in proc_syscalls.c */
+	struct proc *p_vforkparent;	/* Whose address space we're using */
+	bool *p_vforkdone;		/* Set (under its p_lock) when we stop */
+	struct wchan *p_vforkwchan;	/* Threads waiting for vfork children */
 #endif
 };
 
 #if OPT_A2
 
-// lock for modifying the process table, since multiple threads may change it
-struct lock *proc_table_lock;
+/*
+ * The console is the only file a process can have open, so its
+ * descriptor table is just a mask of which descriptors are open
+ * (p_openfds) and which of those are for writing (p_wrfds): stdin is
+ * read-only, stdout and stderr are write-only, and a copy made with
+ * dup2 is like the original. New processes start with the three
+ * standard descriptors; fork copies the masks and spawn's file
+ * actions change them. Descriptors go up to PROC_NFDS-1.
+ */
+#define PROC_NFDS		32
+#define PROC_STDFDS		0x7	/* stdin, stdout, stderr */
+#define PROC_STDWRFDS		0x6	/* stdout, stderr */
+#define PROC_FDBIT(fd)		((uint32_t)1 << (fd))
+#define PROC_FDISOPEN(fds, fd)	\
+	((fd) >= 0 && (fd) < PROC_NFDS && ((fds) & PROC_FDBIT(fd)) != 0)
+
+/*
+ * Exit record for a thread created with __thread_create, kept until
+ * the thread is joined or the process goes away.
+ */
+struct uthread {
+	struct uthread *ut_next;
+	int ut_tid;
+	bool ut_exited;
+	int ut_exitcode;
+};
 
 #define _PROC_RUNNING 1
 #define _PROC_EXITED 0
+#define _PROC_REAPING 2	/* exited, and a waitpid is collecting it */
 
 // additional process information
 // which may still be stored AFTER a process is deleted
 // this could have been put inside process, 
 // but I find it a bit cleaner to put inside a separate structure
+//
+// locking: the table slot, the family fields and exit_code belong to
+// the process table's lock (private to proc.c). status is set to
+// _PROC_EXITED with that lock held exclusive; a waitpid holding it
+// shared claims an exited child by moving it on to _PROC_REAPING with
+// atomic_cas. lock, child_exited_cv and child_events are for this
+// process's threads to wait in waitpid; each exiting child bumps
+// child_events and broadcasts on its parent's cv
 struct proc_info {
 	struct proc *proc;
 
 	struct lock *lock;
-	struct cv *exited_cv;
+	struct cv *child_exited_cv;
+	volatile unsigned child_events;	/* changes under lock */
 
 	pid_t parent_pid;
 	pid_t pid;
-
-	int status;
+	unsigned generation;		/* allocation number of this pid */
+	unsigned parent_generation;	/* ...and of the parent's */
+
+	// family. parent is NULL once the parent has exited; children
+	// lists both running and exited children whose exit codes
+	// haven't been thrown away
+	struct proc_info *parent;
+	struct proc_info *children;
+	struct proc_info *sibling_next;
+	struct proc_info **sibling_prevp;
+
+	volatile int status;
 	int exit_code;
 };
 
 struct proc_info *proc_table_get_process_info(pid_t pid);
 int proc_table_process_exited(pid_t pid, int exitcode);
-
-/* create a new process based on the existing process */
-struct proc *proc_create_forked(void);
+void proc_table_add_child(struct proc_info *parent, struct proc_info *child);
+
+/* wait for child PID (or any, for -1) of PARENT to exit, for waitpid() */
+int proc_table_wait_child(struct proc_info *parent, pid_t pid, bool nohang,
+			  struct proc_info **ret);
+/* ...and let it go once its exit status has been reported (or not) */
+void proc_table_reap_child(struct proc_info *child, bool reported);
+/* wake PARENT's threads in proc_table_wait_child, to notice _exit */
+void proc_table_wake_waiters(struct proc_info *parent);
+
+/* create a new process for fork(); returns EAGAIN if out of pids */
+int proc_create_forked(struct proc **ret);
+/* ...and for spawn() */
+int proc_create_spawned(const char *name, struct proc **ret);
+/* get rid of one of those if it can't be started after all */
+void proc_destroy_unstarted(struct proc *proc);
 
 #endif
 
@@ -130,6 +203,12 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Detach a thread from its process unless it is the last one left.
+ * Returns true if it was detached.
+ */
+bool proc_remthread_unlesslast(struct thread *t);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -0,0 +1,67 @@
+#ifndef _SCHEDSTAT_H_
+#define _SCHEDSTAT_H_
+
+/*
+ * Scheduling statistics.
+ *
+ * With the schedstat kernel option, each cpu counts its voluntary
+ * context switches (the thread went to sleep or yielded) and its
+ * involuntary ones (preempted from hardclock), and keeps log2
+ * histograms, in nanoseconds, of:
+ *
+ *    - run queue wait: from thread_make_runnable until the thread is
+ *      switched in;
+ *    - switch time: from entering thread_switch until switching
+ *      stacks, not counting time spent idle;
+ *    - idle periods: each call to cpu_idle.
+ *
+ * Migrations are counted whether or not the option is on; see
+ * c_migrations. The numbers are printed by the "ss" menu command,
+ * and are meant for tuning the scheduler (SCHEDULE_HARDCLOCKS and
+ * MIGRATE_HARDCLOCKS in clock.c, and the SCHED_* values in cpu.h).
+ *
+ * Timestamps come from clock_nsecs(). Nothing is timed until
+ * schedstat_bootstrap is called, which must be after the clock has
+ * been configured.
+ */
+
+#include "opt-schedstat.h"
+
+#if OPT_SCHEDSTAT
+
+/* Bucket B counts times in [2^B, 2^(B+1)) ns; bucket 0 also gets 0. */
+#define SCHEDSTAT_BUCKETS	32
+
+struct schedhist {
+	uint32_t sh_count[SCHEDSTAT_BUCKETS];
+	uint64_t sh_total;
+	uint64_t sh_max;
+};
+
+/*
+ * Per-cpu statistics. Only the owning cpu updates them, with
+ * interrupts off.
+ */
+struct schedstat {
+	unsigned ss_voluntary;		/* Slept or yielded */
+	unsigned ss_involuntary;	/* Preempted */
+	struct schedhist ss_rqwait;	/* Run queue wait */
+	struct schedhist ss_switch;	/* Time in thread_switch */
+	struct schedhist ss_idle;	/* Time in cpu_idle */
+};
+
+void schedstat_bootstrap(void);
+
+/* Current time in ns, or 0 if statistics aren't being collected yet. */
+uint64_t schedstat_now(void);
+
+/* Add a time of NS to histogram SH. */
+void schedstat_record(struct schedhist *sh, uint64_t ns);
+
+/* Print, or clear, the statistics of cpus 0..NUM-1. */
+void schedstat_print(struct schedstat *const *stats, unsigned num);
+void schedstat_reset(struct schedstat *ss);
+
+#endif /* OPT_SCHEDSTAT */
+
+#endif /* _SCHEDSTAT_H_ */
@@ -0,0 +1,56 @@
+#ifndef _SPLSTAT_H_
+#define _SPLSTAT_H_
+
+/*
+ * Interrupts-off latency tracing.
+ *
+ * With the splstat kernel option, each cpu notes when interrupts go
+ * off (the current thread's t_iplhigh_count goes from 0 to 1, in
+ * splx or spinlock_acquire) and who turned them off, and when they go
+ * back on charges the time in between to that call site. For each
+ * call site we keep the number of such sections and their total and
+ * longest time. The "splstat" menu command prints the call sites
+ * sorted by longest section, which is where to look for code that
+ * keeps timer and disk interrupts waiting.
+ *
+ * The call site is the return address of splx or spinlock_acquire;
+ * splhigh is inline, so for it that is the code calling splhigh.
+ * A section that starts in thread_switch ends in whichever thread
+ * runs next, and is charged to thread_switch. Time spent in cpu_idle
+ * is left out (see splstat_idle), and so are interrupt handlers, which
+ * don't go through splx to turn interrupts off.
+ *
+ * Timestamps come from clock_nsecs(). Nothing is recorded until
+ * splstat_bootstrap is called, which must be after the clock has been
+ * configured.
+ */
+
+#include "opt-splstat.h"
+
+#if OPT_SPLSTAT
+
+void splstat_bootstrap(void);
+
+/* Current time in ns, or 0 if statistics aren't being collected yet. */
+uint64_t splstat_now(void);
+
+/*
+ * splstat_irqoff is called right after raising the IPL, and does
+ * something only if that turned interrupts off. splstat_irqon is
+ * called right before lowering it, and does something only if that
+ * will turn them on. Both must be called with interrupts off.
+ *
+ * splstat_idle leaves the time since IDLESTART (from splstat_now)
+ * out of the current section.
+ */
+void splstat_irqoff(const void *callsite);
+void splstat_irqon(void);
+void splstat_idle(uint64_t idlestart);
+
+/* Print the statistics, sorted by longest section; or clear them. */
+void splstat_print(void);
+void splstat_reset(void);
+
+#endif /* OPT_SPLSTAT */
+
+#endif /* _SPLSTAT_H_ */
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include "opt-lockstat.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -48,11 +49,22 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+        unsigned sem_waiters;           /* Threads asleep in P */
+        unsigned sem_handoffs;          /* Units V handed to woken threads */
+        bool sem_fifo;                  /* Hand off to waiters in order */
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
 
+/*
+ * By default a thread coming into P may take a unit ahead of threads
+ * already asleep in P. With FIFO set, V hands its unit directly to
+ * the longest waiter instead, so waiters are served strictly in
+ * order at some cost in throughput.
+ */
+void sem_setfifo(struct semaphore *, bool fifo);
+
 /*
  * Operations (both atomic):
  *     P (proberen): decrement count. If the count is 0, block until
@@ -78,7 +90,15 @@ struct lock {
         // (don't forget to mark things volatile as needed)
         struct wchan *lk_wchan;
         struct spinlock lk_spinlock;
-        volatile struct thread *lk_holder_thread;
+        volatile struct thread *volatile lk_holder_thread;
+        volatile unsigned lk_waiters;   // threads asleep on lk_wchan
+        bool lk_fifo;                   // hand off to waiters in order
+        bool lk_handoff;                // handed to lk_holder_thread by
+                                        // lock_release; not picked up yet
+#if OPT_LOCKSTAT
+        struct lockstat *lk_stat;       // stats entry for current hold
+        uint64_t lk_acqtime;            // when the current hold began
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -99,6 +119,14 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * By default, lock_release hands a contended lock directly to the
+ * thread that has waited longest. Clearing FIFO instead just wakes
+ * that thread up to compete for the lock, which lets a running thread
+ * barge in ahead of it: better throughput, but no bound on waiting.
+ */
+void lock_setfifo(struct lock *, bool fifo);
+
 
 /*
  * Condition variable.
@@ -140,4 +168,58 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of threads may hold the lock shared (for reading), or one
+ * thread may hold it exclusive (for writing). Waiting writers take
+ * precedence over new readers, so a steady stream of readers cannot
+ * starve a writer out. Neither mode may be acquired recursively.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rw_name;
+        struct wchan *rw_readwchan;     /* Readers waiting */
+        struct wchan *rw_writewchan;    /* Writers waiting */
+        struct wchan *rw_upgradewchan;  /* Upgrader waiting */
+        struct spinlock rw_lock;
+        volatile unsigned rw_readers;   /* Threads holding it shared */
+        volatile unsigned rw_waitingwriters;
+        struct thread *rw_writer;       /* Thread holding it exclusive */
+        struct thread *rw_upgrader;     /* Reader waiting to upgrade */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared.
+ *    rwlock_release_read  - Give up a shared hold.
+ *    rwlock_acquire_write - Get the lock exclusive.
+ *    rwlock_release_write - Give up an exclusive hold.
+ *    rwlock_upgrade       - Turn the caller's shared hold into an
+ *                           exclusive one, waiting for other readers
+ *                           to leave. Only one reader can be upgrading
+ *                           at a time; if another is, fails and
+ *                           returns false, and the caller still holds
+ *                           the lock shared.
+ *    rwlock_downgrade     - Turn the caller's exclusive hold into a
+ *                           shared one, without letting a writer in
+ *                           between.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock exclusive. (Shared holders aren't
+ *                           tracked individually.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
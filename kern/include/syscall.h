@@ -50,6 +50,22 @@ void enter_forked_process(void *tf, unsigned int unused);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
+#if OPT_A2
+struct spawn_action; /* from <kern/spawn.h> */
+struct argbuf; /* from <argbuf.h> */
+
+/*
+ * Start program PROGNAME with arguments ARGS in a new process, a
+ * child of the current one (unless that's the kernel), after doing
+ * the file actions. Returns the new pid in *RETVAL. On success the
+ * new process takes over ARGS's buffer; the caller should call
+ * argbuf_cleanup either way.
+ */
+int proc_spawn(const char *progname, struct argbuf *args,
+	       const struct spawn_action *actions, int nactions,
+	       pid_t *retval);
+#endif
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -57,16 +73,38 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
+int sys___futex_wait(userptr_t uaddr, int val);
+int sys___futex_wake(userptr_t uaddr, int count, int *retval);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
+/* Tear down the current process; called by its last thread. */
+void proc_exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 #if OPT_A2
 int sys_execv(struct trapframe *tf, pid_t *retval);
 int sys_fork(struct trapframe *tf, pid_t *retval);
-char **copy_argv_to_user_stack(char **argv_kern, int num_args, vaddr_t *stackptr);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys___spawn(userptr_t path, userptr_t argv, userptr_t actions,
+		int nactions, pid_t *retval);
+
+int sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t arg,
+			userptr_t stack, int *retval);
+void sys___thread_exit(int code);
+int sys___thread_join(int tid, userptr_t status);
+
+/*
+ * Leave the current user thread; if WHOLEPROC, make the rest of the
+ * process's threads leave too. The last thread out calls proc_exit.
+ * Does not return.
+ */
+void uthread_exit(int code, bool wholeproc);
+
+/* Called on the way back to user mode: leave if the process is exiting. */
+void uthread_checkexit(void);
 #endif
 #endif // UW
 
@@ -59,6 +59,9 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int spinlocktest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -83,6 +86,12 @@ int nettest(int, char **);
 /* Routine for running a user-level program. */
 #if OPT_A2
 int runprogram(char *progname, char **args, int nargs);
+
+/* The loading part of runprogram, for a program already opened on V. */
+struct vnode;
+struct argbuf;
+int runprogram_load(struct vnode *v, struct argbuf *args,
+		    userptr_t *argv, vaddr_t *stackptr, vaddr_t *entrypoint);
 #else
 int runprogram(char *progname);
 #endif
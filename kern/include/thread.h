@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-schedstat.h"
 
 struct cpu;
 
@@ -83,6 +84,14 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	int t_tid;			/* User thread id within t_proc */
+	unsigned t_priority;		/* Run queue level; 0 is highest */
+	unsigned t_quantum;		/* Hardclocks left in this quantum */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastrun;		/* t_lastcpu's c_hardclocks back then */
+#if OPT_SCHEDSTAT
+	uint64_t t_readytime;		/* When last made runnable, in ns */
+#endif
 
 	/*
 	 * Interrupt state fields.
@@ -156,16 +165,48 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for one hardclock, and preempt it if its
+ * quantum is used up or a higher-priority thread is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Potentially pull ready threads over from a busier CPU. Called from
+ * the timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * thread_numcpus returns the number of CPUs in the system.
+ *
+ * thread_setactivecpus restricts the scheduler to CPUs 0 through N-1:
+ * the others stop stealing, and hand over their threads and anything
+ * forked or woken on them. Used to measure how a workload scales;
+ * pass thread_numcpus() to undo.
+ */
+unsigned thread_numcpus(void);
+void thread_setactivecpus(unsigned n);
+
+/*
+ * Check if a thread is currently running on some CPU. T is only
+ * compared against each CPU's current thread, never dereferenced, so
+ * it is safe to pass a thread that might have exited. The answer is
+ * unlocked and may be out of date by the time it is returned.
+ */
+bool thread_isrunning(const struct thread *t);
+
+/*
+ * Print, or clear, per-CPU scheduler statistics (see schedstat.h).
+ */
+void thread_printstats(void);
+void thread_resetstats(void);
+
 
 #endif /* _THREAD_H_ */
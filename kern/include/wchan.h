@@ -81,5 +81,23 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up one thread like wchan_wakeone, but return it (or NULL if
+ * nobody was sleeping). This is for handing something, such as
+ * ownership of a lock, directly to the woken thread. The returned
+ * pointer is only safe to use if the caller holds a lock the woken
+ * thread must get before it looks at what it's been handed.
+ */
+struct thread *wchan_handoff(struct wchan *wc);
+
+/*
+ * Move sleeping threads from one wait channel to another without
+ * waking them: one thread if ALL is false, otherwise all of them.
+ * Returns the number of threads moved. Neither channel should already
+ * be locked. FROM is locked before TO, so callers must not also
+ * transfer in the other direction between the same two channels.
+ */
+unsigned wchan_transfer(struct wchan *from, struct wchan *to, bool all);
+
 
 #endif /* _WCHAN_H_ */
@@ -0,0 +1,58 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: run functions later, in a kernel thread, to get work
+ * off the critical path of whoever asked for it.
+ *
+ * A workqueue has one worker thread and one queue per cpu. Work is
+ * queued on the submitting cpu's queue (or, for delayed work, the
+ * queue of the cpu whose timer fired) and run in the order it was
+ * queued there. Workers run in thread context, so work functions may
+ * sleep.
+ *
+ * A struct work is supplied by the caller, usually embedded in the
+ * object the work is about, so submitting never allocates. Set it up
+ * with work_init. An item can be queued at most once at a time:
+ * submitting one that is already pending does nothing and returns
+ * false. It stops being pending just before its function is called,
+ * so the function may resubmit it, or free it.
+ *
+ * workqueue_submit_delayed queues the work after TICKS hardclocks.
+ *
+ * workqueue_flush waits until all work queued on WQ before the call
+ * has finished running. (Delayed work whose timer hasn't gone off yet
+ * hasn't been queued.) Don't call it from work on the same queue.
+ *
+ * sys_workqueue is a general-purpose queue for the rest of the kernel,
+ * created by workqueue_bootstrap.
+ */
+
+#include <callout.h>
+
+struct workqueue;	/* Opaque */
+
+struct work {
+	struct work *w_next;		/* Link in queue */
+	void (*w_func)(void *);		/* Function to run... */
+	void *w_arg;			/* ...and its argument */
+	struct workqueue *w_wq;		/* Queue for delayed submission */
+	struct callout w_callout;	/* Timer for delayed submission */
+	volatile int w_pending;		/* Queued or timer running */
+};
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+void work_cleanup(struct work *w);
+
+struct workqueue *workqueue_create(const char *name);
+void workqueue_destroy(struct workqueue *wq);
+
+bool workqueue_submit(struct workqueue *wq, struct work *w);
+bool workqueue_submit_delayed(struct workqueue *wq, struct work *w,
+			      unsigned ticks);
+void workqueue_flush(struct workqueue *wq);
+
+extern struct workqueue *sys_workqueue;
+void workqueue_bootstrap(void);
+
+#endif /* _WORKQUEUE_H_ */
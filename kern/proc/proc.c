@@ -43,12 +43,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <atomic.h>
 #include <kern/fcntl.h>  
 
 #include "opt-A2.h"
@@ -73,34 +78,194 @@ struct semaphore *no_proc_sem;
 #endif  // UW
 
 #if OPT_A2
-/* Process table */
+/*
+ * Process table.
+ *
+ * proc_table_lock covers the slots of process_info_table, the family
+ * links in each proc_info, and each process's status and exit code.
+ * It is a reader-writer lock. waitpid looks for its child with it held
+ * shared, and claims it with atomic_cas on its status (see proc_info
+ * in proc.h); everything that changes the table takes it exclusive:
+ * fork (linking a child), exit (orphaning children and posting the
+ * exit code), process creation (filling in a slot) and removing an
+ * entry, including the reaping at the end of waitpid. Each takes it
+ * for time that doesn't depend on how many processes there are.
+ * Nothing that allocates memory or sleeps for long is done with it
+ * held.
+ *
+ * A parent waits for its children on its own proc_info's lock and
+ * child_exited_cv, so waiting doesn't hold anything another process
+ * needs, and one child's exit wakes only its own parent.
+ */
 static struct proc_info **process_info_table = NULL;
+static struct rwlock *proc_table_lock;
+
+/*
+ * PID allocation. Bit i of pid_bitmap is set while pid __PID_MIN + i
+ * is in use (including while its exit status is still wanted).
+ * Allocation is next-fit: the search starts just past the last pid
+ * handed out, a word at a time, so pids aren't reused until the
+ * whole range has gone by and the cost doesn't depend on how many
+ * processes exist.
+ *
+ * pid_generation counts allocations; each proc_info records its own,
+ * so a stale pid can be told apart from a new process that got the
+ * same pid later.
+ *
+ * There is no lock: a pid is claimed by setting its bit with
+ * atomic_cas on the bitmap word, and whoever loses a race for a word
+ * just looks at it again. pid_next is only a hint (two allocations
+ * racing may start from the same place, which costs a retry at
+ * most), so it is read and written plainly.
+ */
+#define PID_WORDBITS	32
+#define PID_WORDS	((__MAX_PROCESSES + PID_WORDBITS - 1) / PID_WORDBITS)
+#define PID_BIT(idx)	((uint32_t)1 << ((idx) % PID_WORDBITS))
+
+static volatile int pid_bitmap[PID_WORDS];
+static volatile unsigned pid_next;	/* Index to start the next search at */
+static volatile int pid_generation;
 
 static void proc_table_init()
 {
+	proc_table_lock = rwlock_create("proc table lock");
+	if (proc_table_lock == NULL) {
+		panic("proc_table_init: Out of memory\n");
+	}
+
 	process_info_table = kmalloc( (__MAX_PROCESSES) * sizeof(struct proc_info *));
+	if (process_info_table == NULL) {
+		panic("proc_table_init: Out of memory\n");
+	}
 	int i = 0;
 	for (i=0; i< __MAX_PROCESSES; i++) {
 		process_info_table[i] = NULL;
 	}
+
+	/* bits past the end of the range are never free */
+	for (i = __MAX_PROCESSES; i < PID_WORDS * PID_WORDBITS; i++) {
+		pid_bitmap[i / PID_WORDBITS] |= PID_BIT(i);
+	}
+	pid_next = 0;
+}
+
+/*
+ * Index of the lowest clear bit in WORD, which must not be all ones.
+ */
+static unsigned pid_ffz(uint32_t word) {
+	unsigned bit = 0;
+
+	word = ~word;
+	if ((word & 0xffff) == 0) { word >>= 16; bit += 16; }
+	if ((word & 0xff) == 0) { word >>= 8; bit += 8; }
+	if ((word & 0xf) == 0) { word >>= 4; bit += 4; }
+	if ((word & 0x3) == 0) { word >>= 2; bit += 2; }
+	if ((word & 0x1) == 0) { bit += 1; }
+	return bit;
+}
+
+/*
+ * Allocate a pid, and a generation number to go with it. Returns
+ * EAGAIN if they're all in use.
+ */
+static int pid_alloc(pid_t *ret, unsigned *generation) {
+	unsigned i, w, start, startword, idx;
+	uint32_t old, bits;
+
+	start = pid_next;
+	startword = start / PID_WORDBITS;
+	/* one extra step comes back round to the bits below start */
+	for (i = 0; i <= PID_WORDS; i++) {
+		w = (startword + i) % PID_WORDS;
+		while (1) {
+			old = (uint32_t)pid_bitmap[w];
+			bits = old;
+			if (i == 0) {
+				/* ignore bits below the starting point for now */
+				bits |= PID_BIT(start) - 1;
+			}
+			if (bits == 0xffffffff) {
+				break;
+			}
+			idx = w * PID_WORDBITS + pid_ffz(bits);
+			KASSERT(idx < __MAX_PROCESSES);
+			if (atomic_cas(&pid_bitmap[w], (int)old,
+				       (int)(old | PID_BIT(idx)))) {
+				pid_next = (idx + 1) % __MAX_PROCESSES;
+				*generation = atomic_fetchadd(&pid_generation, 1) + 1;
+				*ret = (pid_t)(idx + __PID_MIN);
+				return 0;
+			}
+			/* somebody changed the word under us; look again */
+		}
+	}
+	return EAGAIN;
+}
+
+static void pid_free(pid_t pid) {
+	unsigned idx = pid - __PID_MIN;
+	volatile int *word = &pid_bitmap[idx / PID_WORDBITS];
+	uint32_t old;
+
+	do {
+		old = (uint32_t)*word;
+		KASSERT(old & PID_BIT(idx));
+	} while (!atomic_cas(word, (int)old, (int)(old & ~PID_BIT(idx))));
 }
 
 /*
  * Gets the process table information at the current index
+ * Callers that care about the answer staying true must hold proc_table_lock.
 */
 struct proc_info *proc_table_get_process_info(pid_t pid) {
-	if (pid < __PID_MIN || pid > __PID_MAX) {
+	if (pid < __PID_MIN || pid >= __PID_MIN + __MAX_PROCESSES) {
 		return NULL;
 	}
 	int idx = pid - __PID_MIN;
 	return process_info_table[idx];
 }
 
+/*
+ * Take CHILD off its parent's list of children.
+ */
+static void proc_table_unlink_child(struct proc_info *child) {
+	KASSERT(child->parent != NULL);
+
+	*child->sibling_prevp = child->sibling_next;
+	if (child->sibling_next != NULL) {
+		child->sibling_next->sibling_prevp = child->sibling_prevp;
+	}
+	child->parent = NULL;
+	child->sibling_next = NULL;
+	child->sibling_prevp = NULL;
+}
+
+/*
+ * Make CHILD a child of PARENT.
+ */
+void proc_table_add_child(struct proc_info *parent, struct proc_info *child) {
+	rwlock_acquire_write(proc_table_lock);
+	KASSERT(child->parent == NULL);
+
+	child->parent = parent;
+	child->parent_pid = parent->pid;
+	child->parent_generation = parent->generation;
+
+	child->sibling_next = parent->children;
+	if (parent->children != NULL) {
+		parent->children->sibling_prevp = &child->sibling_next;
+	}
+	child->sibling_prevp = &parent->children;
+	parent->children = child;
+	rwlock_release_write(proc_table_lock);
+}
+
 /*
  * Removes the process table information at the current index
 */
 static void proc_table_remove(pid_t pid) {
-	KASSERT(pid >= __PID_MIN && pid <= __PID_MAX);
+	KASSERT(pid >= __PID_MIN && pid < __PID_MIN + __MAX_PROCESSES);
+	KASSERT(rwlock_do_i_hold_write(proc_table_lock));
 
 	int idx = pid - __PID_MIN;
 
@@ -108,52 +273,82 @@ static void proc_table_remove(pid_t pid) {
 
 	// should only be called if the process has already exited
 	KASSERT(cur_proc_info->proc == NULL);
+	// ...and has no children left to look after
+	KASSERT(cur_proc_info->children == NULL);
+
+	if (cur_proc_info->parent != NULL) {
+		proc_table_unlink_child(cur_proc_info);
+	}
 
 	lock_destroy(cur_proc_info->lock);
-  	cv_destroy(cur_proc_info->exited_cv);
+	cv_destroy(cur_proc_info->child_exited_cv);
 	kfree(cur_proc_info);
 
 	// can use this pid for later processes
 	process_info_table[idx] = NULL;
+	pid_free(pid);
 }
 
 /* 
  * Add a process to the process table and assign a PID to it
 */
 static int proc_table_add_process(struct proc *process) {
-	if (process_info_table == NULL) {
-		proc_table_init();
+	// create a new process info structure
+	struct proc_info *proc_info = kmalloc(sizeof(*proc_info));
+	if (proc_info == NULL) {
+		return ENOMEM;
 	}
 
-	int cur_id = 0;
+	proc_info->lock = lock_create("process waitpid lock");
+	if (proc_info->lock == NULL) {
+		kfree(proc_info);
+		return ENOMEM;
+	}
 
-	// find valid location in the array and set a process there
-	while(process_info_table[cur_id] != NULL && cur_id < __MAX_PROCESSES) {
-		cur_id ++;
+	proc_info->child_exited_cv = cv_create("child exited cv");
+	if (proc_info->child_exited_cv == NULL) {
+		lock_destroy(proc_info->lock);
+		kfree(proc_info);
+		return ENOMEM;
+	}
+
+	// set the process's pid upon creation
+	pid_t pid;
+	unsigned generation;
+	int result = pid_alloc(&pid, &generation);
+	if (result) {
+		cv_destroy(proc_info->child_exited_cv);
+		lock_destroy(proc_info->lock);
+		kfree(proc_info);
+		return result;
 	}
 
-	// create a new process info structure
-	struct proc_info *proc_info = kmalloc(sizeof(*proc_info));
 	proc_info->proc = process;
 	proc_info->status = _PROC_RUNNING;
-	// set the process's pid upon creation
-	proc_info->pid = (pid_t)(cur_id + __PID_MIN);
+	proc_info->pid = pid;
+	proc_info->generation = generation;
 	proc_info->parent_pid = 0; // no parent for now, let fork() handle this
+	proc_info->parent_generation = 0;
+	proc_info->parent = NULL;
+	proc_info->children = NULL;
+	proc_info->sibling_next = NULL;
+	proc_info->sibling_prevp = NULL;
 	proc_info->exit_code = 0;
-
-	proc_info->lock = lock_create("process waitpid lock");
-	if (proc_info->lock == NULL) {
-		panic("process lock_create failed\n");
-	}
-
-	proc_info->exited_cv = cv_create("process exited cv");
-	if (proc_info->exited_cv == NULL) {
-		panic("process exited cv_create failed\n");
-	}
+	proc_info->child_events = 0;
 
 	process->info = proc_info;
 
-	process_info_table[cur_id] = proc_info;
+	// the pid is ours, but waitpid() may be looking at the table
+	// (except while making kproc: nothing else is running, and there
+	// isn't a curthread to hold a sleep lock yet)
+	if (kproc == NULL) {
+		process_info_table[pid - __PID_MIN] = proc_info;
+	}
+	else {
+		rwlock_acquire_write(proc_table_lock);
+		process_info_table[pid - __PID_MIN] = proc_info;
+		rwlock_release_write(proc_table_lock);
+	}
 
 	return 0;
 }
@@ -161,41 +356,42 @@ static int proc_table_add_process(struct proc *process) {
 /* 
  * Handle a process exiting
  * Clean up:
- * 	1. If its children has already exited, this process will no longer need their exit codes
- * 	   so remove the children from the process table
+ * 	1. Children that have already exited are removed from the process table, since
+ * 	   nobody needs their exit codes any more; the rest are orphaned
  * 	2. If its parent has exited, remove the entry from the process table
  *
+ * Both only look at the process's own children, so the cost doesn't depend on how
+ * many other processes there are.
+ *
  * Note:
  * process_info_table[idx]->status == _PROC_EXITED means it has exited but it's exit code is still needed
  * process_info_table[idx] == NULL means it has exited
 */
 int proc_table_process_exited(pid_t pid, int exitcode) {
-	// need to clean up the proc_info structures of all its children
+	struct proc_info *child;
 
 	KASSERT( pid >= __PID_MIN && pid <= __PID_MAX);
- 
+
+	rwlock_acquire_write(proc_table_lock);
+
+	int idx = pid - __PID_MIN;
+	struct proc_info *cur_proc_info = proc_table_get_process_info(pid);
+
 	// 1. clean up all its children who have exited
-	// since it no longer cares about their exit codes
-	// TODO: this is inefficient.. use an arraylist
-	int i = 0;
-	for (i=0; i<__MAX_PROCESSES; i++) {
-		if (process_info_table[i] != NULL 
-			&& process_info_table[i]->status == _PROC_EXITED 
-			&& process_info_table[i]->parent_pid == pid)
-		{
-			proc_table_remove(process_info_table[i]->pid);
+	// since it no longer cares about their exit codes,
+	// and orphan the ones still running
+	while ((child = cur_proc_info->children) != NULL) {
+		if (child->status == _PROC_EXITED) {
+			proc_table_remove(child->pid);
+		}
+		else {
+			proc_table_unlink_child(child);
 		}
 	}
 
 	// 2. if its parent has exited, then it should clean itself up since nobody cares about it anymore
-	int idx = pid - __PID_MIN;
-	struct proc_info *cur_proc_info = proc_table_get_process_info(pid);
-	struct proc_info *parent_proc_info = proc_table_get_process_info(cur_proc_info->parent_pid);
-
-	// parent already exited (NULL) OR another other process has taken up its spot  
-	if (parent_proc_info == NULL 
-		|| parent_proc_info->status == _PROC_EXITED 
-		|| parent_proc_info->pid != cur_proc_info->parent_pid) {
+	// (an exiting parent orphans its children, so this is just a NULL check)
+	if (cur_proc_info->parent == NULL) {
 
 		// remove current process info from the table
 		proc_table_remove(pid);
@@ -203,36 +399,149 @@ int proc_table_process_exited(pid_t pid, int exitcode) {
 
 	// there are still processes "interested" in this exitcode (its parent still alive)
 	if (process_info_table[idx] != NULL) {
-		lock_acquire(cur_proc_info->lock);
-			cur_proc_info->exit_code = exitcode;
-			cur_proc_info->status = _PROC_EXITED;
-			// signal to the waiting parent that this process has exited
-			cv_signal(cur_proc_info->exited_cv, cur_proc_info->lock);
-
-		lock_release(cur_proc_info->lock);
+		cur_proc_info->exit_code = exitcode;
+		cur_proc_info->status = _PROC_EXITED;
+		// tell the parent, in case it's waiting
+		proc_table_wake_waiters(cur_proc_info->parent);
 	}
 
+	rwlock_release_write(proc_table_lock);
+
 	return 0;
 }
+
+void proc_table_wake_waiters(struct proc_info *parent) {
+	lock_acquire(parent->lock);
+	parent->child_events++;
+	cv_broadcast(parent->child_exited_cv, parent->lock);
+	lock_release(parent->lock);
+}
+
+/*
+ * Claim CHILD for waitpid if it has exited and nobody else has
+ * claimed it yet.
+ */
+static bool proc_table_claim(struct proc_info *child) {
+	return atomic_cas(&child->status, _PROC_EXITED, _PROC_REAPING);
+}
+
+/*
+ * Wait for waitpid(): for child PID of PARENT to exit, or with
+ * WAIT_ANY, for any of its children. The child found is claimed
+ * (_PROC_REAPING) so that nobody else reports it too, and returned in
+ * *RET; the caller must hand it to proc_table_reap_child. With NOHANG,
+ * *RET is NULL if the child (or every child) is still running.
+ *
+ * ESRCH if PID isn't a process; ECHILD if it isn't PARENT's child, or
+ * for WAIT_ANY, if PARENT has no children; EINTR if the process is
+ * exiting (see uthread_exit).
+ */
+int proc_table_wait_child(struct proc_info *parent, pid_t pid, bool nohang,
+			  struct proc_info **ret) {
+	struct proc_info *child;
+	unsigned events;
+	int result = 0;
+
+	rwlock_acquire_read(proc_table_lock);
+	while (1) {
+		// anything that happens from here on changes this
+		events = parent->child_events;
+
+		if (pid == WAIT_ANY) {
+			if (parent->children == NULL) {
+				result = ECHILD;
+				break;
+			}
+			for (child = parent->children; child != NULL;
+			     child = child->sibling_next) {
+				if (proc_table_claim(child)) {
+					break;
+				}
+			}
+		}
+		else {
+			child = proc_table_get_process_info(pid);
+			if (child == NULL) {
+				result = ESRCH;
+				break;
+			}
+			if (child->parent != parent) {
+				result = ECHILD;
+				break;
+			}
+			if (!proc_table_claim(child)) {
+				child = NULL;
+			}
+		}
+
+		if (child != NULL || nohang) {
+			break;
+		}
+
+		// sleep until a child exits, unless one already has since we
+		// looked (or another waiter gave one back, or it went away)
+		lock_acquire(parent->lock);
+		rwlock_release_read(proc_table_lock);
+		if (curproc->p_exiting) {
+			lock_release(parent->lock);
+			*ret = NULL;
+			return EINTR;
+		}
+		if (parent->child_events == events) {
+			cv_wait(parent->child_exited_cv, parent->lock);
+		}
+		lock_release(parent->lock);
+		rwlock_acquire_read(proc_table_lock);
+	}
+	rwlock_release_read(proc_table_lock);
+
+	*ret = child;
+	return result;
+}
+
+/*
+ * Finish with CHILD from proc_table_wait_child. If its exit status was
+ * REPORTED it's gone for good; if not (the status couldn't be copied
+ * out) it goes back to waiting to be collected.
+ *
+ * While it's claimed nothing else touches CHILD: its parent (which is
+ * us) can't exit, so it can't be orphaned or removed.
+ */
+void proc_table_reap_child(struct proc_info *child, bool reported) {
+	struct proc_info *parent = child->parent;
+
+	KASSERT(child->status == _PROC_REAPING);
+	if (reported) {
+		rwlock_acquire_write(proc_table_lock);
+		proc_table_remove(child->pid);
+		// others waiting for this pid find it gone
+		proc_table_wake_waiters(parent);
+		rwlock_release_write(proc_table_lock);
+	}
+	else {
+		child->status = _PROC_EXITED;
+		proc_table_wake_waiters(parent);
+	}
+}
 #endif
 
 /*
  * Create a proc structure.
  */
 static
-struct proc *
-proc_create(const char *name)
+int
+proc_create(const char *name, struct proc **ret)
 {
 	struct proc *proc;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
-		return NULL;
+		return ENOMEM;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
 		kfree(proc);
-		return NULL;
+		return ENOMEM;
 	}
 
 	threadarray_init(&proc->p_threads);
@@ -249,11 +558,50 @@ proc_create(const char *name)
 #endif // UW
 
 #if OPT_A2
+	/* user-level threads */
+	proc->p_uthreads = NULL;
+	proc->p_nexttid = 1;
+	proc->p_joinwchan = wchan_create("p_joinwchan");
+	if (proc->p_joinwchan == NULL) {
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return ENOMEM;
+	}
+	proc->p_exiting = false;
+	proc->p_exitcode = 0;
+	proc->p_openfds = PROC_STDFDS;
+	proc->p_wrfds = PROC_STDWRFDS;
+
+	/* vfork */
+	proc->p_vforkparent = NULL;
+	proc->p_vforkdone = NULL;
+	proc->p_vforkwchan = wchan_create("p_vforkwchan");
+	if (proc->p_vforkwchan == NULL) {
+		wchan_destroy(proc->p_joinwchan);
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return ENOMEM;
+	}
+
 	/* add the process to the table of processes and get its id */
-	proc_table_add_process(proc);
+	int result = proc_table_add_process(proc);
+	if (result) {
+		wchan_destroy(proc->p_vforkwchan);
+		wchan_destroy(proc->p_joinwchan);
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+		return result;
+	}
 #endif
 
-	return proc;
+	*ret = proc;
+	return 0;
 }
 
 /*
@@ -277,6 +625,16 @@ proc_destroy(struct proc *proc)
 #if OPT_A2
 	// lets lingering info (exitcode) know that the process has already exited
 	proc->info->proc = NULL; 
+
+	/* exit records of threads nobody joined */
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
+	wchan_destroy(proc->p_joinwchan);
+	KASSERT(proc->p_vforkparent == NULL);
+	wchan_destroy(proc->p_vforkwchan);
 #endif
 
 	/*
@@ -348,12 +706,11 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
-#ifdef OPT_A2
-  proc_table_lock = lock_create("proc table lock");
+#if OPT_A2
+  proc_table_init();
 #endif
 
-  kproc = proc_create("[kernel]");
-  if (kproc == NULL) {
+  if (proc_create("[kernel]", &kproc)) {
     panic("proc_create for kproc failed\n");
   }
 #ifdef UW
@@ -370,20 +727,22 @@ proc_bootstrap(void)
 }
 
 /*
- * Create a fresh proc for use by runprogram.
+ * Create a fresh proc for a user program.
  *
  * It will have no address space and will inherit the current
- * process's (that is, the kernel menu's) current directory.
+ * process's current directory.
  */
-struct proc *
-proc_create_runprogram(const char *name)
+static
+int
+proc_create_user(const char *name, struct proc **ret)
 {
 	struct proc *proc;
 	char *console_path;
+	int result;
 
-	proc = proc_create(name);
-	if (proc == NULL) {
-		return NULL;
+	result = proc_create(name, &proc);
+	if (result) {
+		return result;
 	}
 
 #ifdef UW
@@ -430,9 +789,72 @@ proc_create_runprogram(const char *name)
 	V(proc_count_mutex);
 #endif // UW
 
+	*ret = proc;
+	return 0;
+}
+
+/*
+ * Create a fresh proc for use by runprogram.
+ */
+struct proc *
+proc_create_runprogram(const char *name)
+{
+	struct proc *proc;
+
+	if (proc_create_user(name, &proc)) {
+		return NULL;
+	}
 	return proc;
 }
 
+#if OPT_A2
+/*
+ * Create a proc for fork(). The caller fills in the address space
+ * and parent. Returns EAGAIN if there are no free pids.
+ */
+int
+proc_create_forked(struct proc **ret)
+{
+	return proc_create_user("[Forked]", ret);
+}
+
+/*
+ * Create a proc for spawn(), to run program NAME.
+ */
+int
+proc_create_spawned(const char *name, struct proc **ret)
+{
+	return proc_create_user(name, ret);
+}
+
+/*
+ * Undo proc_create_forked or proc_create_spawned for a process that
+ * never got a thread; its address space, if any, is the caller's
+ * business. It goes away completely, pid and all, as if it had never
+ * been a child of anybody.
+ */
+void
+proc_destroy_unstarted(struct proc *proc)
+{
+	struct proc_info *info = proc->info;
+	struct proc_info *parent;
+
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+
+	proc_destroy(proc);
+
+	rwlock_acquire_write(proc_table_lock);
+	parent = info->parent;
+	proc_table_remove(info->pid);
+	if (parent != NULL) {
+		// another thread of the parent may be in waitpid(-1) on
+		// account of this child; it may have no children now
+		proc_table_wake_waiters(parent);
+	}
+	rwlock_release_write(proc_table_lock);
+}
+#endif
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -483,6 +905,41 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Remove a thread from its process, but only if other threads remain.
+ * Deciding and removing under the same lock means that when several
+ * threads leave at once exactly one of them is left attached, and
+ * that one can tear the process down knowing nobody else is still
+ * using it.
+ */
+bool
+proc_remthread_unlesslast(struct thread *t)
+{
+	struct proc *proc;
+	unsigned i, num;
+
+	proc = t->t_proc;
+	KASSERT(proc != NULL);
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	if (num == 1) {
+		KASSERT(threadarray_get(&proc->p_threads, 0) == t);
+		spinlock_release(&proc->p_lock);
+		return false;
+	}
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			t->t_proc = NULL;
+			spinlock_release(&proc->p_lock);
+			return true;
+		}
+	}
+	spinlock_release(&proc->p_lock);
+	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
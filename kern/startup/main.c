@@ -47,8 +47,13 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <futex.h>
 #include <test.h>
 #include <version.h>
+#include <lockstat.h>
+#include <schedstat.h>
+#include <splstat.h>
+#include <workqueue.h>
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -108,6 +113,7 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
 	proc_bootstrap();
+	futex_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
@@ -120,11 +126,24 @@ boot(void)
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
+#if OPT_LOCKSTAT
+	/* Needs the clock, which is configured above. */
+	lockstat_bootstrap();
+#endif
+#if OPT_SCHEDSTAT
+	schedstat_bootstrap();
+#endif
+#if OPT_SPLSTAT
+	splstat_bootstrap();
+#endif
+	/* Tickless idle needs the clock too. */
+	hardclock_tickless_bootstrap();
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
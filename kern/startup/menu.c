@@ -42,6 +42,10 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <argbuf.h>
+#include <lockstat.h>
+#include <splstat.h>
+#include "opt-A2.h"
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -74,6 +78,50 @@ getinterval(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2,
 //
 // Command menu functions 
 
+#if OPT_A2
+/*
+ * Common code for cmd_prog and cmd_shell.
+ *
+ * The program gets its own process, started with proc_spawn, which
+ * copies the arguments; we then wait until it (and any others it
+ * starts) has finished.
+ */
+static
+int
+common_prog(int nargs, char **args)
+{
+	struct argbuf ab;
+	pid_t pid;
+	int result;
+
+#if OPT_SYNCHPROBS
+	kprintf("Warning: this probably won't work with a "
+		"synchronization-problems kernel.\n");
+#endif
+
+	result = argbuf_init(&ab);
+	if (result == 0) {
+		result = argbuf_set(&ab, args, nargs);
+	}
+	if (result == 0) {
+		result = proc_spawn(args[0], &ab, NULL, 0, &pid);
+	}
+	argbuf_cleanup(&ab);
+	if (result) {
+		kprintf("Running program %s failed: %s\n", args[0],
+			strerror(result));
+		return result;
+	}
+
+#ifdef UW
+	/* wait until the process we have just launched - and any others that it 
+	   may fork - is finished before proceeding */
+	P(no_proc_sem);
+#endif // UW
+
+	return 0;
+}
+#else
 /*
  * Function for a thread that runs an arbitrary userlevel program by
  * name.
@@ -95,23 +143,16 @@ cmd_progthread(void *ptr, unsigned long nargs)
 
 	KASSERT(nargs >= 1);
 
-#if OPT_A2
-#else
 	if (nargs > 2) {
 		kprintf("Warning: argument passing from menu not supported\n");
 	}
-#endif
 
 	/* Hope we fit. */
 	KASSERT(strlen(args[0]) < sizeof(progname));
 
 	strcpy(progname, args[0]);
 
-#if OPT_A2
-	result = runprogram(progname, args, nargs);
-#else
 	result = runprogram(progname);
-#endif
 
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
@@ -170,6 +211,7 @@ common_prog(int nargs, char **args)
 
 	return 0;
 }
+#endif
 
 /*
  * Command for running an arbitrary userlevel program.
@@ -208,6 +250,84 @@ cmd_shell(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+#ifdef UW
+/*
+ * Run a program on 1, 2, ... N cpus (see thread_setactivecpus) and
+ * report the speedup over one cpu. This relies on common_prog waiting
+ * for the program to finish.
+ */
+static
+int
+speedup_run(int nargs, char **args)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long ms, basems, speedup;
+	unsigned n, numcpus;
+	int result;
+
+	numcpus = thread_numcpus();
+	basems = 0;
+	result = 0;
+	for (n = 1; n <= numcpus; n++) {
+		thread_setactivecpus(n);
+
+		gettime(&beforesecs, &beforensecs);
+		result = common_prog(nargs, args);
+		gettime(&aftersecs, &afternsecs);
+		if (result) {
+			break;
+		}
+
+		getinterval(beforesecs, beforensecs,
+			    aftersecs, afternsecs,
+			    &secs, &nsecs);
+		ms = (unsigned long)secs * 1000 + nsecs / 1000000;
+		if (n == 1) {
+			basems = ms;
+		}
+		speedup = ms > 0 ? basems * 100 / ms : 0;
+
+		kprintf("%s: %u cpu%s: %lu.%03lu seconds, speedup %lu.%02lu\n",
+			args[0], n, n == 1 ? "" : "s", ms / 1000, ms % 1000,
+			speedup / 100, speedup % 100);
+	}
+	thread_setactivecpus(numcpus);
+
+	return result;
+}
+
+/*
+ * Command for measuring multiprocessor speedup. With no arguments,
+ * runs parallelvm and psort.
+ */
+static
+int
+cmd_speedup(int nargs, char **args)
+{
+	static char parallelvm[] = "/testbin/parallelvm";
+	static char psort[] = "/testbin/psort";
+	char *progargs[2];
+	int result;
+
+	if (nargs > 1) {
+		/* drop the leading "sb" */
+		return speedup_run(nargs - 1, args + 1);
+	}
+
+	progargs[1] = NULL;
+
+	progargs[0] = parallelvm;
+	result = speedup_run(1, progargs);
+	if (result) {
+		return result;
+	}
+
+	progargs[0] = psort;
+	return speedup_run(1, progargs);
+}
+#endif // UW
+
 /*
  * Command for changing directory.
  */
@@ -416,6 +536,75 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKSTAT
+/*
+ * Command for printing (or, with "reset", clearing) lock statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: lockstat [reset]\n");
+		return EINVAL;
+	}
+
+	lockstat_print();
+
+	return 0;
+}
+#endif
+
+#if OPT_SPLSTAT
+/*
+ * Command for printing (or, with "reset", clearing) interrupts-off
+ * statistics.
+ */
+static
+int
+cmd_splstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		splstat_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: splstat [reset]\n");
+		return EINVAL;
+	}
+
+	splstat_print();
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for printing (or, with "reset", clearing) scheduler
+ * statistics.
+ */
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		thread_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: ss [reset]\n");
+		return EINVAL;
+	}
+
+	thread_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -486,6 +675,9 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[rw1] Rwlock test                   ",
+	"[rw2] Rwlock read throughput        ",
+	"[sl1] Spinlock throughput/fairness  ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -525,6 +717,16 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ss] Scheduler stats [reset]        ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock stats [reset]       ",
+#endif
+#if OPT_SPLSTAT
+	"[splstat] IRQ-off stats [reset]     ",
+#endif
+#ifdef UW
+	"[sb] Multiprocessor speedup [prog]  ",
+#endif // UW
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -581,6 +783,16 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ss",		cmd_schedstats },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
+#if OPT_SPLSTAT
+	{ "splstat",	cmd_splstat },
+#endif
+#ifdef UW
+	{ "sb",		cmd_speedup },
+#endif // UW
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -598,6 +810,9 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "rw1",	rwtest },
+	{ "rw2",	rwtest2 },
+	{ "sl1",	spinlocktest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -0,0 +1,167 @@
+/*
+ * Packed program arguments. See argbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <copyinout.h>
+#include <argbuf.h>
+
+/* A released buffer, kept for the next argbuf_init. */
+static struct spinlock argbuf_lock = SPINLOCK_INITIALIZER;
+static char *argbuf_spare;
+
+int
+argbuf_init(struct argbuf *ab)
+{
+	spinlock_acquire(&argbuf_lock);
+	ab->ab_data = argbuf_spare;
+	argbuf_spare = NULL;
+	spinlock_release(&argbuf_lock);
+
+	if (ab->ab_data == NULL) {
+		ab->ab_data = kmalloc(ARG_MAX);
+		if (ab->ab_data == NULL) {
+			return ENOMEM;
+		}
+	}
+	ab->ab_len = 0;
+	ab->ab_argc = 0;
+	return 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	char *data = ab->ab_data;
+
+	if (data == NULL) {
+		return;
+	}
+	ab->ab_data = NULL;
+
+	spinlock_acquire(&argbuf_lock);
+	if (argbuf_spare == NULL) {
+		argbuf_spare = data;
+		data = NULL;
+	}
+	spinlock_release(&argbuf_lock);
+
+	if (data != NULL) {
+		kfree(data);
+	}
+}
+
+/*
+ * Room left for string bytes, once there's space for the pointers to
+ * what's there already, one more, and the NULL.
+ */
+static
+size_t
+argbuf_room(struct argbuf *ab)
+{
+	size_t used;
+
+	used = ab->ab_len + (ab->ab_argc + 2) * sizeof(userptr_t);
+	return used < ARG_MAX ? ARG_MAX - used : 0;
+}
+
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv)
+{
+	userptr_t uarg;
+	size_t room, len;
+	int result;
+
+	KASSERT(ab->ab_argc == 0);
+
+	while (1) {
+		result = copyin((const_userptr_t)uargv, &uarg, sizeof(uarg));
+		if (result) {
+			return result;
+		}
+		if (uarg == NULL) {
+			return 0;
+		}
+
+		room = argbuf_room(ab);
+		if (room == 0) {
+			return E2BIG;
+		}
+		result = copyinstr((const_userptr_t)uarg,
+				   ab->ab_data + ab->ab_len, room, &len);
+		if (result == ENAMETOOLONG) {
+			return E2BIG;
+		}
+		if (result) {
+			return result;
+		}
+		ab->ab_len += len;
+		ab->ab_argc++;
+		uargv = (userptr_t)((vaddr_t)uargv + sizeof(userptr_t));
+	}
+}
+
+int
+argbuf_set(struct argbuf *ab, char **args, int nargs)
+{
+	size_t len;
+	int i;
+
+	KASSERT(ab->ab_argc == 0);
+
+	for (i=0; i<nargs; i++) {
+		len = strlen(args[i]) + 1;
+		if (len > argbuf_room(ab)) {
+			return E2BIG;
+		}
+		memcpy(ab->ab_data + ab->ab_len, args[i], len);
+		ab->ab_len += len;
+		ab->ab_argc++;
+	}
+	return 0;
+}
+
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv)
+{
+	userptr_t *ptrs;
+	size_t ptrsize, total, len;
+	vaddr_t base, str;
+	int i, result;
+
+	/*
+	 * The stack image is argv[0..argc] and then the strings; base
+	 * is where it starts, which is also the new stack pointer and
+	 * so must be 8-aligned.
+	 */
+	ptrsize = (ab->ab_argc + 1) * sizeof(userptr_t);
+	total = ptrsize + ab->ab_len;
+	KASSERT(total <= ARG_MAX);
+	base = (*stackptr - total) & ~(vaddr_t)7;
+
+	memmove(ab->ab_data + ptrsize, ab->ab_data, ab->ab_len);
+	ptrs = (userptr_t *)ab->ab_data;
+	str = base + ptrsize;
+	for (i=0; i<ab->ab_argc; i++) {
+		ptrs[i] = (userptr_t)str;
+		len = strlen(ab->ab_data + (str - base)) + 1;
+		str += len;
+	}
+	ptrs[ab->ab_argc] = NULL;
+
+	result = copyout(ab->ab_data, (userptr_t)base, total);
+	if (result == EFAULT) {
+		/* the stack is new, so it must be too small for them */
+		return E2BIG;
+	}
+	if (result) {
+		return result;
+	}
+	*stackptr = base;
+	*argv = (userptr_t)base;
+	return 0;
+}
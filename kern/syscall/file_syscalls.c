@@ -8,6 +8,7 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include "opt-A2.h"
 
 /* handler for write() system call                  */
 /*
@@ -29,11 +30,24 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
 
   DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
   
+  KASSERT(curproc != NULL);
+#if OPT_A2
+  /* only stdout and stderr writes are currently implemented, but
+     they may have been closed or copied elsewhere (see proc.h) */
+  if (!PROC_FDISOPEN(curproc->p_wrfds, fdesc)) {
+    if ((fdesc==STDOUT_FILENO || fdesc==STDERR_FILENO) &&
+        !PROC_FDISOPEN(curproc->p_openfds, fdesc)) {
+      /* closed by spawn's file actions */
+      return EBADF;
+    }
+    return EUNIMP;
+  }
+#else
   /* only stdout and stderr writes are currently implemented */
   if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
     return EUNIMP;
   }
-  KASSERT(curproc != NULL);
+#endif
   KASSERT(curproc->console != NULL);
   KASSERT(curproc->p_addrspace != NULL);
 
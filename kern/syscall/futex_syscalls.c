@@ -0,0 +1,254 @@
+/*
+ * Futex system calls. See futex.h.
+ *
+ * A waiter counts itself on the futex and notes its wake sequence
+ * number before reading the user word, and __futex_wake bumps the
+ * sequence number under the same bucket lock. So a wake that comes
+ * between the read and the sleep is noticed rather than lost. The
+ * price is that such a wake can let go of more threads than it asked
+ * for; as usual with futexes, callers must cope with spurious
+ * returns.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <futex.h>
+#include "opt-A2.h"
+
+/* Number of hash buckets; must be a power of 2. */
+#define FUTEX_HASHSIZE	64
+
+struct futex {
+	struct futex *f_next;		/* Link in bucket */
+	struct addrspace *f_as;		/* Key: address space... */
+	vaddr_t f_addr;			/* ...and user address */
+	struct wchan *f_wchan;		/* Where waiters sleep */
+	unsigned f_waiters;		/* Threads in __futex_wait on this */
+	unsigned f_wakeseq;		/* Bumped by every wake */
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex *fb_head;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_head = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	unsigned hash;
+
+	hash = ((uintptr_t)as >> 4) * 31 + (addr >> 2);
+	return &futex_table[hash & (FUTEX_HASHSIZE - 1)];
+}
+
+/* Call with the bucket locked. */
+static
+struct futex *
+futex_lookup(struct futex_bucket *fb, struct addrspace *as, vaddr_t addr)
+{
+	struct futex *f;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (f = fb->fb_head; f != NULL; f = f->f_next) {
+		if (f->f_as == as && f->f_addr == addr) {
+			break;
+		}
+	}
+	return f;
+}
+
+/*
+ * Find or create the futex for (AS, ADDR) and count the caller as
+ * waiting on it. On success, returns with the bucket locked.
+ */
+static
+int
+futex_get(struct futex_bucket *fb, struct addrspace *as, vaddr_t addr,
+	  struct futex **ret)
+{
+	struct futex *f, *newf;
+
+	spinlock_acquire(&fb->fb_lock);
+	f = futex_lookup(fb, as, addr);
+	if (f == NULL) {
+		/* don't allocate with the bucket locked */
+		spinlock_release(&fb->fb_lock);
+		newf = kmalloc(sizeof(*newf));
+		if (newf == NULL) {
+			return ENOMEM;
+		}
+		newf->f_wchan = wchan_create("futex");
+		if (newf->f_wchan == NULL) {
+			kfree(newf);
+			return ENOMEM;
+		}
+		newf->f_as = as;
+		newf->f_addr = addr;
+		newf->f_waiters = 0;
+		newf->f_wakeseq = 0;
+
+		spinlock_acquire(&fb->fb_lock);
+		f = futex_lookup(fb, as, addr);
+		if (f == NULL) {
+			newf->f_next = fb->fb_head;
+			fb->fb_head = newf;
+			f = newf;
+		}
+		else {
+			/* somebody else got there first */
+			wchan_destroy(newf->f_wchan);
+			kfree(newf);
+		}
+	}
+	f->f_waiters++;
+	*ret = f;
+	return 0;
+}
+
+/*
+ * Stop counting the caller as waiting on F, and get rid of F if
+ * nobody else is. Call with the bucket locked; unlocks it.
+ */
+static
+void
+futex_put(struct futex_bucket *fb, struct futex *f)
+{
+	struct futex **fp;
+
+	KASSERT(f->f_waiters > 0);
+	f->f_waiters--;
+	if (f->f_waiters > 0) {
+		spinlock_release(&fb->fb_lock);
+		return;
+	}
+
+	for (fp = &fb->fb_head; *fp != f; fp = &(*fp)->f_next) {
+		KASSERT(*fp != NULL);
+	}
+	*fp = f->f_next;
+	spinlock_release(&fb->fb_lock);
+
+	wchan_destroy(f->f_wchan);
+	kfree(f);
+}
+
+int
+sys___futex_wait(userptr_t uaddr, int val)
+{
+	struct addrspace *as = curproc_getas();
+	vaddr_t addr = (vaddr_t)uaddr;
+	struct futex_bucket *fb;
+	struct futex *f;
+	unsigned seq;
+	int cur, result;
+
+	if (addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fb = futex_bucket(as, addr);
+	result = futex_get(fb, as, addr, &f);
+	if (result) {
+		return result;
+	}
+	seq = f->f_wakeseq;
+	spinlock_release(&fb->fb_lock);
+
+	/* copyin may fault, so it can't be done with the bucket locked */
+	result = copyin(uaddr, &cur, sizeof(cur));
+
+	spinlock_acquire(&fb->fb_lock);
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+#if OPT_A2
+	if (result == 0 && curproc->p_exiting) {
+		/* checked after counting ourselves; see futex_exiting */
+		result = EINTR;
+	}
+#endif
+	if (result == 0 && f->f_wakeseq == seq) {
+		wchan_lock(f->f_wchan);
+		spinlock_release(&fb->fb_lock);
+		wchan_sleep(f->f_wchan);
+		spinlock_acquire(&fb->fb_lock);
+	}
+	futex_put(fb, f);
+	return result;
+}
+
+int
+sys___futex_wake(userptr_t uaddr, int count, int *retval)
+{
+	struct addrspace *as = curproc_getas();
+	vaddr_t addr = (vaddr_t)uaddr;
+	struct futex_bucket *fb;
+	struct futex *f;
+	int woken;
+
+	if (addr % sizeof(int) != 0 || count < 0) {
+		return EINVAL;
+	}
+
+	fb = futex_bucket(as, addr);
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	f = futex_lookup(fb, as, addr);
+	if (f != NULL) {
+		f->f_wakeseq++;
+		while (woken < count && wchan_handoff(f->f_wchan) != NULL) {
+			woken++;
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+/*
+ * Wake everyone waiting on a futex in AS. The caller must already
+ * have marked the process as exiting, so that anyone who comes along
+ * later sees that rather than going to sleep.
+ */
+void
+futex_exiting(struct addrspace *as)
+{
+	struct futex_bucket *fb;
+	struct futex *f;
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		fb = &futex_table[i];
+		spinlock_acquire(&fb->fb_lock);
+		for (f = fb->fb_head; f != NULL; f = f->f_next) {
+			if (f->f_as == as) {
+				f->f_wakeseq++;
+				wchan_wakeall(f->f_wchan);
+			}
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
@@ -12,110 +12,41 @@
 #include "opt-A2.h"
 
 #if OPT_A2
-#include <spl.h>
 #include <synch.h>
+#include <wchan.h>
 #include <mips/trapframe.h>
 #include <array.h>
 
 #include <kern/fcntl.h>
+#include <limits.h>
 #include <vfs.h>
+#include <argbuf.h>
+
+/*
+ * If the current process is a vfork child, it is done with its
+ * parent's address space, which must no longer be curproc's: let the
+ * parent go on. Called from execv and proc_exit.
+ */
+static void
+vfork_release(void)
+{
+  struct proc *p = curproc;
+  struct proc *parent = p->p_vforkparent;
 
-static void copy_argv_to_kern(char **argv, char **argv_kern, int num_args) {
-  for (int idx = 0; idx < num_args; idx ++) {
-
-    DEBUG(DB_PROC_SYSCALL, "argv[%d]: %s \n", idx, argv[idx]);
-
-    int str_len = strlen(argv[idx]);
-    DEBUG(DB_PROC_SYSCALL, "length of argv[%d]: %d \n", idx, str_len);
-
-    void *usersrc = argv[idx];
-
-    // copy it into kernel space
-
-    argv_kern[idx] = kmalloc( (str_len + 1) * sizeof(char));
-
-    size_t result_str_len;
-    copyinstr(usersrc, argv_kern[idx], str_len * sizeof(char), &result_str_len);
-
-    DEBUG(DB_PROC_SYSCALL, "bytes copied of argv[%d]: %d \n", idx, result_str_len);
-    DEBUG(DB_PROC_SYSCALL, "copied result: %s \n", argv_kern[idx]);
-    DEBUG(DB_PROC_SYSCALL, "---------------\n");
-  }
-}
-
-char **copy_argv_to_user_stack(char **argv_kern, int num_args, vaddr_t *stackptr){
-  // make sure no interrupt while messing aroud with addresses
-  int spl = splhigh();
-
-  int char_addresses[num_args + 1];
-
-  // copy NULL terminator
-  *stackptr -= 4;
-  copyout((void *)0, (userptr_t) *stackptr, 4);
-  char_addresses[num_args] = *stackptr;
-
-  DEBUG(DB_PROC_SYSCALL, "Copy strings pointers to user stack... \n");
-
-  // copy each string to the user stack
-  for (int idx = num_args-1; idx >= 0; idx --) {
-    
-    const char *str = argv_kern[idx];
-
-    int str_len = strlen(str) + 1; // includes null terminator
-
-    DEBUG(DB_PROC_SYSCALL, "Copying: %s\n", str);  
-    DEBUG(DB_PROC_SYSCALL, "str_len: %d\n", str_len);  
-
-    // pad by 4 bits so that its pointers are bit aligned
-    int padding = 0;
-    if (str_len % 4 != 0) {
-      padding = 4 - str_len % 4;
-    }
-
-    DEBUG(DB_PROC_SYSCALL, "Padding: %d \n", padding);
-
-    *stackptr -= (str_len + padding);
-    
-    size_t bytes_copied;
-    copyoutstr(str, (userptr_t) *stackptr, (size_t)str_len, &bytes_copied);
-
-    char_addresses[idx] = *stackptr;
-
-    DEBUG(DB_PROC_SYSCALL, "Bytes Copied: %d \n", bytes_copied);
-    DEBUG(DB_PROC_SYSCALL, "Space Taken: %d \n", str_len + padding);
-    DEBUG(DB_PROC_SYSCALL, "--------\n");
-  }
-
-  DEBUG(DB_PROC_SYSCALL, "Copy char pointers to user stack... \n");
-
-  // copy each char pointer to the user stack
-  for (int idx = num_args; idx >= 0; idx --) {
-      // copy char pointer
-      *stackptr -= 4;
-      copyout((void *)&char_addresses[idx], (userptr_t)*stackptr, 4);
-
-      DEBUG(DB_PROC_SYSCALL, "argv[%d] (@ %x )--> %x \n", idx, *stackptr, char_addresses[idx]);
-  }
-
-  // copy pointer to char pointers (char ** argv)
-  copyout((void *)stackptr, (userptr_t)(*stackptr - 4), 4);
-  *stackptr -= 4;
-
-  // pointer to the argv before the bit aligning the stack ptr
-  char **argv_user = (char **)(* stackptr);
-
-  // Make sure stack pointer is 8 bit aligned
-  DEBUG(DB_PROC_SYSCALL, "Previous Stack Pointer: %x\n", *stackptr);
-
-  if (*stackptr % 8 != 0) {
-    *stackptr -= (8 - *stackptr % 8);
+  if (parent == NULL) {
+    return;
   }
+  KASSERT(p->p_addrspace != parent->p_addrspace);
 
-  DEBUG(DB_PROC_SYSCALL, "Aligned Stack Pointer: %x\n", *stackptr);
+  spinlock_acquire(&parent->p_lock);
+  *p->p_vforkdone = true;
+  wchan_wakeall(parent->p_vforkwchan);
+  spinlock_release(&parent->p_lock);
 
-  splx(spl);
-  return argv_user;
-};
+  // the parent (and the flag on its stack) may be gone from here on
+  p->p_vforkparent = NULL;
+  p->p_vforkdone = NULL;
+}
 
 int
 sys_execv(struct trapframe *tf, pid_t *retval) {
@@ -123,63 +54,96 @@ sys_execv(struct trapframe *tf, pid_t *retval) {
   *retval = 0;
   int result;
   vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  struct argbuf args;
+  struct vnode *v;
+
+  // the other threads would be left running in the old address space
+  spinlock_acquire(&curproc->p_lock);
+  if (threadarray_num(&curproc->p_threads) > 1) {
+    spinlock_release(&curproc->p_lock);
+    return EBUSY;
+  }
+  spinlock_release(&curproc->p_lock);
 
-  char *progname = (char *)tf->tf_a0;
-  struct vnode *v = curproc->p_cwd;
-
-  // Open the file using the current working directory. 
-  result = vfs_open(progname, O_RDONLY, 0, &v);
+  // copy in the path and the arguments while the old address space
+  // is still there to copy them from
+  char *progname = kmalloc(PATH_MAX);
+  if (progname == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr((const_userptr_t)tf->tf_a0, progname, PATH_MAX, NULL);
   if (result) {
+    kfree(progname);
     return result;
   }
 
-  char **argv = (char **)tf->tf_a1;
-  
-  int argc = 0;
-  while (argv[argc] != NULL) {
-    argc ++;
+  result = argbuf_init(&args);
+  if (result) {
+    kfree(progname);
+    return result;
+  }
+  result = argbuf_copyin(&args, (userptr_t)tf->tf_a1);
+  if (result) {
+    argbuf_cleanup(&args);
+    kfree(progname);
+    return result;
   }
 
-  // argv arguments on the kernel
-  char *argv_kern[argc];
-  copy_argv_to_kern(argv, argv_kern, argc);
-
-  // replace the address space of the calling process 
-  // with a new address space containing a new program.
-  struct addrspace *as;
-  as_deactivate();
-  as = curproc_setas(NULL);
-  as_destroy(as); // destroy the old address space
+  // Open the file using the current working directory. 
+  result = vfs_open(progname, O_RDONLY, 0, &v);
+  kfree(progname);
+  if (result) {
+    argbuf_cleanup(&args);
+    return result;
+  }
 
+  // build the new address space, keeping the old one until nothing
+  // can fail, so that a failed execv returns to the old program
   struct addrspace *entering_as = as_create();
-  if (entering_as ==NULL) {
+  if (entering_as == NULL) {
     vfs_close(v);
+    argbuf_cleanup(&args);
     return ENOMEM;
   }
-  // use the newly created address space
-  curproc_setas(entering_as);
+  as_deactivate();
+  struct addrspace *old_as = curproc_setas(entering_as);
   as_activate();
 
   // Load the executable.
   result = load_elf(v, &entrypoint);
-  if (result) {
-    vfs_close(v);
-    return result;
-  }
 
   // Done with the file now.
   vfs_close(v);
 
-  // Define the user stack in the address space
-  result = as_define_stack(curproc->p_addrspace, &stackptr);
+  // Define the user stack in the address space, and put the arguments on it
+  if (result == 0) {
+    result = as_define_stack(entering_as, &stackptr);
+  }
+  if (result == 0) {
+    result = argbuf_copyout(&args, &stackptr, &argv);
+  }
+  int argc = args.ab_argc;
+  argbuf_cleanup(&args);
+
   if (result) {
+    // back to the old program
+    as_deactivate();
+    curproc_setas(old_as);
+    as_activate();
+    as_destroy(entering_as);
     return result;
   }
 
-  // copy the strings to the user stack and get the pointer to it
-  char **argv_user = copy_argv_to_user_stack(argv_kern, argc, &stackptr);
-  
-  enter_new_process(argc /*argc*/, (userptr_t) *argv_user /*userspace addr of argv*/,
+  if (curproc->p_vforkparent != NULL) {
+    // it was our parent's; give it back
+    vfork_release();
+  }
+  else {
+    as_destroy(old_as); // destroy the old address space
+  }
+
+  enter_new_process(argc /*argc*/, argv /*userspace addr of argv*/,
         stackptr, entrypoint);
 
   // should not reach here
@@ -187,40 +151,70 @@ sys_execv(struct trapframe *tf, pid_t *retval) {
   return 0;
 }
 
-int 
-sys_fork(struct trapframe *tf, pid_t *retval) 
+/*
+ * Common part of fork() and vfork(). With BORROW, the child runs on
+ * the parent's address space instead of a copy, and the calling
+ * thread sleeps until the child gives it back by calling execv or
+ * _exit (see vfork_release). The caller's stack is shared too, so
+ * the child must not return from the function that called vfork.
+ *
+ * That sleep can't be given up early, as the child would still be
+ * running on our address space, so a process with other threads (any
+ * of which could _exit meanwhile) gets a copy instead, as for fork.
+ */
+static int
+fork_common(struct trapframe *tf, pid_t *retval, bool borrow)
 {
-  // disable interrupts : makes sure addr space doesn't change before copying
-  int spl = splhigh();
+  // no need to turn interrupts off: the address space's layout only
+  // changes in execv, which can't run while we're here in another thread
   int err;
+  pid_t pid;
+  bool vfork_done = false;
+
+  if (borrow) {
+    // only we can add threads, so this stays true until we're done
+    spinlock_acquire(&curproc->p_lock);
+    if (threadarray_num(&curproc->p_threads) > 1) {
+      borrow = false;
+    }
+    spinlock_release(&curproc->p_lock);
+  }
 
   // create a new process based on the current process
   // copies the address as well
-  lock_acquire(proc_table_lock);
-  struct proc* new_proc = proc_create_runprogram("[Forked]");
-  lock_release(proc_table_lock);
+  struct proc* new_proc;
+  err = proc_create_forked(&new_proc);
 
-  // Out of memory
-  if (new_proc == NULL) {
-    splx(spl);
-    return ENOMEM;
+  // Out of memory or pids
+  if (err) {
+    return err;
   }
+  new_proc->p_openfds = curproc->p_openfds;
+  new_proc->p_wrfds = curproc->p_wrfds;
 
-  // copy the current process's address space
   struct addrspace *cur_addrspace = curproc_getas();
-  struct addrspace *as;
-  err = as_copy(cur_addrspace, &as);
-  if (err) {
-    splx(spl);
-    return ENOMEM;
+  if (borrow) {
+    // the child uses our address space until it execs or exits
+    new_proc->p_addrspace = cur_addrspace;
+    new_proc->p_vforkparent = curproc;
+    new_proc->p_vforkdone = &vfork_done;
+  }
+  else {
+    // copy the current process's address space
+    struct addrspace *as;
+    err = as_copy(cur_addrspace, &as);
+    if (err) {
+      proc_destroy_unstarted(new_proc);
+      return ENOMEM;
+    }
+    new_proc->p_addrspace = as;
   }
-  new_proc->p_addrspace = as;
 
   // set its parent pid to the pid of the current process
   KASSERT(new_proc->info != NULL);
   KASSERT(curproc->info != NULL);
 
-  new_proc->info->parent_pid = curproc->info->pid; 
+  proc_table_add_child(curproc->info, new_proc->info);
 
   // make a copy of the trap frame so its child has a copy of it 
   // if parent returns to child before child thread executes
@@ -229,11 +223,14 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 
   struct trapframe *tf_copy = kmalloc(sizeof(struct trapframe));
   if (tf_copy == NULL) {
-    splx(spl);
-    return ENOMEM;
+    err = ENOMEM;
+    goto fail;
   }
   *tf_copy = *tf;
 
+  // once the child is running it may exit and free new_proc at any time
+  pid = new_proc->info->pid;
+
   // create a new thread to enter the forked process
 
   err = thread_fork(
@@ -244,26 +241,80 @@ sys_fork(struct trapframe *tf, pid_t *retval)
       0);
 
   if (err) {
-      splx(spl);
       kfree(tf_copy);
-      return err;
+      goto fail;
   }
 
   // may need to copy more stuff - file table??
 
+  if (borrow) {
+    // wait for the child to be done with our address space
+    spinlock_acquire(&curproc->p_lock);
+    while (!vfork_done) {
+      // nobody else in this process to _exit (see above)
+      KASSERT(!curproc->p_exiting);
+      wchan_lock(curproc->p_vforkwchan);
+      spinlock_release(&curproc->p_lock);
+      wchan_sleep(curproc->p_vforkwchan);
+      spinlock_acquire(&curproc->p_lock);
+    }
+    spinlock_release(&curproc->p_lock);
+  }
+
   // set the return value of the parent to the PID of the forked process
-  *retval = new_proc->info->pid;
+  *retval = pid;
 
-  splx(spl);
   return 0;
+
+ fail:
+  if (!borrow) {
+    as_destroy(new_proc->p_addrspace);
+  }
+  new_proc->p_addrspace = NULL;
+  new_proc->p_vforkparent = NULL;
+  proc_destroy_unstarted(new_proc);
+  return err;
+}
+
+int 
+sys_fork(struct trapframe *tf, pid_t *retval) 
+{
+  return fork_common(tf, retval, false);
+}
+
+int 
+sys_vfork(struct trapframe *tf, pid_t *retval) 
+{
+  return fork_common(tf, retval, true);
 }
 #endif
 
+/* work function: destroy an exited process's address space */
+static void
+exit_destroy_as(void *data)
+{
+  as_destroy((struct addrspace *)data);
+}
+
   /* this implementation of sys__exit does not do anything with the exit code */
   /* this needs to be fixed to get exit() and waitpid() working properly */
 
 void sys__exit(int exitcode) {
 
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+
+#if OPT_A2
+  /* other threads in the process follow us out; the last one to go
+     calls proc_exit() */
+  uthread_exit(exitcode, true);
+#else
+  proc_exit(exitcode);
+#endif
+}
+
+/* tear down the current process; called by its last thread */
+void proc_exit(int exitcode) {
+
   struct addrspace *as;
   struct proc *p = curproc;
 
@@ -271,9 +322,8 @@ void sys__exit(int exitcode) {
   pid_t cur_pid = p->info->pid;
 #endif
 
-  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
-
-  KASSERT(curproc->p_addrspace != NULL);
+  /* no KASSERT on p_addrspace: a spawned process that failed to load
+     may not have one */
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -283,7 +333,18 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+#if OPT_A2
+  if (p->p_vforkparent != NULL) {
+    /* a vfork child that never exec'd: the address space is its parent's */
+    vfork_release();
+  }
+  else if (as != NULL)
+#endif
+  {
+    /* tearing down a big address space is slow; leave it to a worker */
+    work_init(&as->as_exitwork, exit_destroy_as, as);
+    workqueue_submit(sys_workqueue, &as->as_exitwork);
+  }
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -294,16 +355,14 @@ void sys__exit(int exitcode) {
   proc_destroy(p);
 
 #if OPT_A2
-lock_acquire(proc_table_lock);
   // Remove it from the process info table
   // handles cleanup of unused process information
   proc_table_process_exited(cur_pid, exitcode);
-lock_release(proc_table_lock);
 #endif
 
   thread_exit();
   /* thread_exit() does not return, so we should never get here */
-  panic("return from thread_exit in sys_exit\n");
+  panic("return from thread_exit in proc_exit\n");
 }
 
 
@@ -335,40 +394,43 @@ sys_waitpid(pid_t pid,
   int exitstatus;
   int result;
 
-  if (options != 0) {
+#if OPT_A2
+  if ((options & ~WNOHANG) != 0) {
     return(EINVAL);
   }
 
-#if OPT_A2
-lock_acquire(proc_table_lock);
-  struct proc_info *child_proc_info = proc_table_get_process_info(pid);
-lock_release(proc_table_lock);
-
-  // The pid argument named a nonexistent process.
+  // ESRCH: The pid argument named a nonexistent process.
+  // ECHILD: The pid argument named a process that the current process 
+  // was not interested in (or, for -1, it has no children at all).
+  // Blocks until a child that will do has exited, unless WNOHANG.
+  struct proc_info *child_proc_info;
+  result = proc_table_wait_child(curproc->info, pid, (options & WNOHANG) != 0,
+                                 &child_proc_info);
+  if (result) {
+    return result;
+  }
   if (child_proc_info == NULL) {
-    return ESRCH;
+    // WNOHANG, and nothing has exited yet
+    *retval = 0;
+    return(0);
   }
 
-  // The pid argument named a process that the current process 
-  // was not interested in or that has not yet exited.
-  if (child_proc_info->parent_pid != curproc->info->pid) {
-    return ECHILD;
-  }
+  // the child is ours to report: nobody else can see it until we
+  // let it go, so it's safe to copy out without the table locked
+  pid = child_proc_info->pid;
+  exitstatus = _MKWAIT_EXIT(child_proc_info->exit_code);
 
-lock_acquire(child_proc_info->lock);
-  // called before a child has exited, so it must block until the child exits
-  while (child_proc_info->status != _PROC_EXITED) {
-    cv_wait(child_proc_info->exited_cv, child_proc_info->lock);
+  result = copyout((void *)&exitstatus,status,sizeof(int));
+  // reap it, unless the status didn't get to the caller
+  proc_table_reap_child(child_proc_info, result == 0);
+  if (result) {
+    return(result);
   }
-
-  KASSERT(child_proc_info->status == _PROC_EXITED);
-lock_release(child_proc_info->lock);
-
-  // child should have exited at this point, 
-  // with its information still stored in its process table
-
-  exitstatus = _MKWAIT_EXIT(child_proc_info->exit_code);
 #else
+  if (options != 0) {
+    return(EINVAL);
+  }
+
   /* this is just a stub implementation that always reports an
      exit status of 0, regardless of the actual exit status of
      the specified process.   
@@ -379,12 +441,12 @@ lock_release(child_proc_info->lock);
 
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
-#endif
 
   result = copyout((void *)&exitstatus,status,sizeof(int));
   if (result) {
     return(result);
   }
+#endif
   *retval = pid;
   return(0);
 }
@@ -44,21 +44,112 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <argbuf.h>
 #include "opt-A2.h"
 
+#if OPT_A2
+/*
+ * Load the program open on V into a fresh address space for the
+ * current process, which must not have one yet, and copy ARGS onto
+ * its stack. Returns what enter_new_process needs. Closes V either
+ * way; on error, the address space (if any) goes away when curproc
+ * is destroyed.
+ */
+int
+runprogram_load(struct vnode *v, struct argbuf *args,
+		userptr_t *argv, vaddr_t *stackptr, vaddr_t *entrypoint)
+{
+	struct addrspace *as;
+	int result;
+
+	/* We should be a new process. */
+	KASSERT(curproc_getas() == NULL);
+
+	/* Create a new address space. */
+	as = as_create();
+	if (as ==NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+
+	/* Switch to it and activate it. */
+	curproc_setas(as);
+	as_activate();
+
+	/* Load the executable. */
+	result = load_elf(v, entrypoint);
+	if (result) {
+		vfs_close(v);
+		return result;
+	}
+
+	/* Done with the file now. */
+	vfs_close(v);
+
+	/* Define the user stack in the address space */
+	result = as_define_stack(as, stackptr);
+	if (result) {
+		return result;
+	}
+
+	/* Put the arguments on it. */
+	return argbuf_copyout(args, stackptr, argv);
+}
+
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
-#if OPT_A2
 int
 runprogram(char *progname, char **args, int nargs)
-#else 
+{
+	struct argbuf ab;
+	struct vnode *v;
+	userptr_t argv;
+	vaddr_t entrypoint, stackptr;
+	int result;
+
+	result = argbuf_init(&ab);
+	if (result) {
+		return result;
+	}
+	result = argbuf_set(&ab, args, nargs);
+	if (result) {
+		argbuf_cleanup(&ab);
+		return result;
+	}
+
+	/* Open the file. */
+	result = vfs_open(progname, O_RDONLY, 0, &v);
+	if (result) {
+		argbuf_cleanup(&ab);
+		return result;
+	}
+
+	result = runprogram_load(v, &ab, &argv, &stackptr, &entrypoint);
+	argbuf_cleanup(&ab);
+	if (result) {
+		return result;
+	}
+
+	/* Warp to user mode. */
+	enter_new_process(nargs /*argc*/, argv, stackptr, entrypoint);
+
+	/* enter_new_process does not return. */
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
+#else
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
 int
 runprogram(char *progname)
-#endif
 {
 	struct addrspace *as;
 	struct vnode *v;
@@ -103,21 +194,12 @@ runprogram(char *progname)
 		return result;
 	}
 
-#if OPT_A2
-	// copy the strings to the user stack and get the pointer to it
-	char **argv_user = copy_argv_to_user_stack(args, nargs, &stackptr);
-
-	/* Warp to user mode. */
-	enter_new_process(nargs /*argc*/, (userptr_t) *argv_user /*userspace addr of argv*/,
-			  stackptr, entrypoint);
-#else
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
 			  stackptr, entrypoint);
-#endif
 
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
 	return EINVAL;
 }
-
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Spawning processes: fork and exec in one step.
+ *
+ * proc_spawn makes a new process and starts a program in it directly.
+ * Nothing of the parent is copied but its current directory and its
+ * open descriptors, so the cost doesn't depend on how big the parent
+ * is, and there is no address space to copy and then throw away.
+ *
+ * The program is opened, and the file actions checked, before the
+ * new process is made, so those errors come back from the call. If
+ * loading the program fails after that, the child exits with status
+ * SPAWN_LOADFAILED, as a shell's child would if exec failed.
+ *
+ * The console is still the only file there is, so the descriptor
+ * table the file actions work on is just p_openfds and p_wrfds (see
+ * proc.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/spawn.h>
+#include <limits.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <test.h>
+#include <argbuf.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+#define SPAWN_LOADFAILED	127
+
+/* What the new process's thread needs to start the program. */
+struct spawn_args {
+	struct vnode *sa_vnode;		/* The program, opened */
+	struct argbuf sa_args;
+};
+
+/*
+ * Do the file actions to the descriptor masks *FDS (open) and *WRFDS
+ * (open for writing).
+ */
+static
+int
+spawn_fileactions(const struct spawn_action *actions, int nactions,
+		  uint32_t *fds, uint32_t *wrfds)
+{
+	const struct spawn_action *a;
+	int i;
+
+	for (i=0; i<nactions; i++) {
+		a = &actions[i];
+		if (!PROC_FDISOPEN(*fds, a->sa_fd)) {
+			return EBADF;
+		}
+		switch (a->sa_op) {
+		    case SPAWN_CLOSE:
+			*fds &= ~PROC_FDBIT(a->sa_fd);
+			*wrfds &= ~PROC_FDBIT(a->sa_fd);
+			break;
+		    case SPAWN_DUP2:
+			if (a->sa_newfd < 0 || a->sa_newfd >= PROC_NFDS) {
+				return EBADF;
+			}
+			/* all open descriptors are the console, but the
+			   copy gets the original's access */
+			*fds |= PROC_FDBIT(a->sa_newfd);
+			if (PROC_FDISOPEN(*wrfds, a->sa_fd)) {
+				*wrfds |= PROC_FDBIT(a->sa_newfd);
+			}
+			else {
+				*wrfds &= ~PROC_FDBIT(a->sa_newfd);
+			}
+			break;
+		    default:
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * First thread of a spawned process.
+ */
+static
+void
+spawn_enter(void *data, unsigned long unused)
+{
+	struct spawn_args *sa = data;
+	userptr_t argv;
+	vaddr_t stackptr, entrypoint;
+	int argc, result;
+
+	(void)unused;
+
+	argc = sa->sa_args.ab_argc;
+	result = runprogram_load(sa->sa_vnode, &sa->sa_args,
+				 &argv, &stackptr, &entrypoint);
+	argbuf_cleanup(&sa->sa_args);
+	kfree(sa);
+	if (result) {
+		kprintf("%s: %s\n", curproc->p_name, strerror(result));
+		proc_exit(SPAWN_LOADFAILED);
+	}
+
+	enter_new_process(argc, argv, stackptr, entrypoint);
+	panic("enter_new_process returned\n");
+}
+
+int
+proc_spawn(const char *progname, struct argbuf *args,
+	   const struct spawn_action *actions, int nactions, pid_t *retval)
+{
+	struct spawn_args *sa;
+	struct proc *proc;
+	struct vnode *v;
+	uint32_t fds, wrfds;
+	char *path;
+	pid_t pid;
+	int result;
+
+	fds = curproc->p_openfds;
+	wrfds = curproc->p_wrfds;
+	result = spawn_fileactions(actions, nactions, &fds, &wrfds);
+	if (result) {
+		return result;
+	}
+
+	/* vfs_open destroys the path it's given */
+	path = kstrdup(progname);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(path, O_RDONLY, 0, &v);
+	kfree(path);
+	if (result) {
+		return result;
+	}
+
+	sa = kmalloc(sizeof(*sa));
+	if (sa == NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+	sa->sa_vnode = v;
+
+	result = proc_create_spawned(progname, &proc);
+	if (result) {
+		kfree(sa);
+		vfs_close(v);
+		return result;
+	}
+	proc->p_openfds = fds;
+	proc->p_wrfds = wrfds;
+
+	/* the kernel menu doesn't wait for its programs with waitpid */
+	if (curproc != kproc) {
+		proc_table_add_child(curproc->info, proc->info);
+	}
+
+	/* once the child is running it may exit and free proc at any time */
+	pid = proc->info->pid;
+
+	/* the child gets the arguments' buffer */
+	sa->sa_args = *args;
+	result = thread_fork(progname, proc, spawn_enter, sa, 0);
+	if (result) {
+		proc_destroy_unstarted(proc);
+		kfree(sa);
+		vfs_close(v);
+		return result;
+	}
+	args->ab_data = NULL;
+
+	*retval = pid;
+	return 0;
+}
+
+int
+sys___spawn(userptr_t upath, userptr_t uargv, userptr_t uactions,
+	    int nactions, pid_t *retval)
+{
+	struct spawn_action actions[SPAWN_ACTIONS_MAX];
+	struct argbuf args;
+	char *path;
+	int result;
+
+	if (nactions < 0 || nactions > SPAWN_ACTIONS_MAX) {
+		return EINVAL;
+	}
+	if (nactions > 0) {
+		result = copyin(uactions, actions,
+				nactions * sizeof(actions[0]));
+		if (result) {
+			return result;
+		}
+	}
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(upath, path, PATH_MAX, NULL);
+	if (result) {
+		kfree(path);
+		return result;
+	}
+
+	result = argbuf_init(&args);
+	if (result) {
+		kfree(path);
+		return result;
+	}
+	result = argbuf_copyin(&args, uargv);
+	if (result == 0) {
+		result = proc_spawn(path, &args, actions, nactions, retval);
+	}
+
+	argbuf_cleanup(&args);
+	kfree(path);
+	return result;
+}
+
+#endif /* OPT_A2 */
@@ -0,0 +1,254 @@
+/*
+ * User-level threads.
+ *
+ * __thread_create starts another thread in the calling process. It
+ * shares the process's address space and enters user mode at ENTRY
+ * with ARG in a0 and its stack pointer at STACK; the caller provides
+ * (and owns) the stack. The new thread gets a thread id, which is
+ * never 0 (that is a process's first thread), and an exit record
+ * that holds its exit code until somebody calls __thread_join on it.
+ *
+ * __thread_exit ends just the calling thread. _exit ends the whole
+ * process: it sets p_exiting, and each of the other threads leaves
+ * the next time it is on its way back to user mode (see
+ * uthread_checkexit, called from mips_trap). Threads that never make
+ * a system call still take clock interrupts, so they notice too.
+ * Whichever thread is last out tears the process down.
+ *
+ * So that they all do get out, every sleep a user thread can get into
+ * that isn't bounded must give up with EINTR once p_exiting is set,
+ * and uthread_exit must wake it: those are __thread_join, futex waits,
+ * waitpid and nanosleep. (vfork waits for its child, which it can't
+ * abandon, so it only borrows the address space when there are no
+ * other threads to _exit; see fork_common.) Any other sleep - for a
+ * lock, for the disk - has to end by itself.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <wchan.h>
+#include <clock.h>
+#include <futex.h>
+#include <vm.h>
+#include <copyinout.h>
+#include <mips/trapframe.h>
+#include "opt-A2.h"
+
+#if OPT_A2
+
+/*
+ * Find the link pointing at the exit record for TID; *result is NULL
+ * if there is none. Call with p_lock held.
+ */
+static
+struct uthread **
+uthread_find(struct proc *p, int tid)
+{
+	struct uthread **utp;
+
+	KASSERT(spinlock_do_i_hold(&p->p_lock));
+
+	for (utp = &p->p_uthreads; *utp != NULL; utp = &(*utp)->ut_next) {
+		if ((*utp)->ut_tid == tid) {
+			break;
+		}
+	}
+	return utp;
+}
+
+/*
+ * Entry point of a new user thread. DATA1 is a trapframe allocated
+ * by sys___thread_create; TID is the thread's id.
+ */
+static
+void
+uthread_enter(void *data1, unsigned long tid)
+{
+	struct trapframe tf;
+
+	/* the trapframe passed to mips_usermode must be on our own stack */
+	tf = *(struct trapframe *)data1;
+	kfree(data1);
+
+	curthread->t_tid = (int)tid;
+
+	/* the process may have started exiting while we were created */
+	uthread_checkexit();
+
+	mips_usermode(&tf);
+}
+
+int
+sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t arg,
+		    userptr_t stack, int *retval)
+{
+	struct proc *p = curproc;
+	struct trapframe *newtf;
+	struct uthread *ut, **utp;
+	int tid, result;
+
+	if ((vaddr_t)entry >= USERSPACETOP || (vaddr_t)stack > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	newtf = kmalloc(sizeof(*newtf));
+	if (newtf == NULL) {
+		return ENOMEM;
+	}
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		kfree(newtf);
+		return ENOMEM;
+	}
+
+	/*
+	 * Start from the caller's registers, so things like gp are
+	 * right, and point it at the new entry point and stack.
+	 */
+	*newtf = *tf;
+	newtf->tf_epc = (vaddr_t)entry;
+	newtf->tf_a0 = (vaddr_t)arg;
+	newtf->tf_sp = (vaddr_t)stack & ~(vaddr_t)7;
+	newtf->tf_ra = 0;
+
+	spinlock_acquire(&p->p_lock);
+	tid = p->p_nexttid++;
+	ut->ut_tid = tid;
+	ut->ut_exited = false;
+	ut->ut_exitcode = 0;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+	spinlock_release(&p->p_lock);
+
+	result = thread_fork("[user thread]", p, uthread_enter, newtf, tid);
+	if (result) {
+		spinlock_acquire(&p->p_lock);
+		utp = uthread_find(p, tid);
+		KASSERT(*utp == ut);
+		*utp = ut->ut_next;
+		spinlock_release(&p->p_lock);
+		kfree(ut);
+		kfree(newtf);
+		return result;
+	}
+
+	*retval = tid;
+	return 0;
+}
+
+void
+uthread_exit(int code, bool wholeproc)
+{
+	struct proc *p = curproc;
+	struct uthread **utp;
+	bool first = false;
+
+	KASSERT(p != NULL && p != kproc);
+
+	spinlock_acquire(&p->p_lock);
+	if (wholeproc && !p->p_exiting) {
+		p->p_exiting = true;
+		p->p_exitcode = code;
+		/* joiners have to go too */
+		wchan_wakeall(p->p_joinwchan);
+		first = true;
+	}
+	if (curthread->t_tid != 0) {
+		utp = uthread_find(p, curthread->t_tid);
+		KASSERT(*utp != NULL);
+		(*utp)->ut_exited = true;
+		(*utp)->ut_exitcode = code;
+		wchan_wakeall(p->p_joinwchan);
+	}
+	spinlock_release(&p->p_lock);
+
+	if (first && p->p_vforkparent == NULL) {
+		/* and so do threads sleeping on futexes (a vfork child's
+		   address space, and so its futexes, are its parent's) */
+		futex_exiting(p->p_addrspace);
+	}
+	if (first) {
+		/* ...and in waitpid and nanosleep */
+		proc_table_wake_waiters(p->info);
+		clocksleep_interrupt();
+	}
+
+	if (proc_remthread_unlesslast(curthread)) {
+		/* curproc cannot be used after this */
+		thread_exit();
+	}
+
+	/*
+	 * We're the last thread, so nobody else can be looking at p.
+	 * If _exit was never called the process exits with status 0.
+	 */
+	proc_exit(p->p_exiting ? p->p_exitcode : 0);
+}
+
+void
+uthread_checkexit(void)
+{
+	struct proc *p = curproc;
+
+	if (p != NULL && p != kproc && p->p_exiting) {
+		uthread_exit(0, false);
+	}
+}
+
+void
+sys___thread_exit(int code)
+{
+	DEBUG(DB_SYSCALL, "Syscall: __thread_exit(%d)\n", code);
+	uthread_exit(code, false);
+}
+
+int
+sys___thread_join(int tid, userptr_t status)
+{
+	struct proc *p = curproc;
+	struct uthread *ut, **utp;
+	int exitcode;
+
+	if (tid == curthread->t_tid) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&p->p_lock);
+	while (1) {
+		utp = uthread_find(p, tid);
+		ut = *utp;
+		if (ut == NULL) {
+			spinlock_release(&p->p_lock);
+			return ESRCH;
+		}
+		if (ut->ut_exited) {
+			break;
+		}
+		if (p->p_exiting) {
+			spinlock_release(&p->p_lock);
+			return EINTR;
+		}
+		wchan_lock(p->p_joinwchan);
+		spinlock_release(&p->p_lock);
+		wchan_sleep(p->p_joinwchan);
+		spinlock_acquire(&p->p_lock);
+	}
+	/* the record is ours now; nobody else can join this thread */
+	*utp = ut->ut_next;
+	spinlock_release(&p->p_lock);
+
+	exitcode = ut->ut_exitcode;
+	kfree(ut);
+
+	if (status != NULL) {
+		return copyout(&exitcode, status, sizeof(int));
+	}
+	return 0;
+}
+
+#endif /* OPT_A2 */
@@ -28,9 +28,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include "opt-A2.h"
 
 /*
  * Example system call: get the time of day.
@@ -56,3 +61,33 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in REQ. The only thing that cuts a sleep short
+ * is another thread calling _exit, and then nobody will look at REM
+ * (where the time left would go), so it is never written.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	int result;
+
+	(void)user_rem;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+#if OPT_A2
+	return clocksleep_ns_intr((uint64_t)req.tv_sec * 1000000000 +
+				  req.tv_nsec, &curproc->p_exiting);
+#else
+	clocksleep_ns((uint64_t)req.tv_sec * 1000000000 + req.tv_nsec);
+	return 0;
+#endif
+}
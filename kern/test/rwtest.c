@@ -0,0 +1,289 @@
+/*
+ * Reader-writer lock tests.
+ *
+ * rw1 is a correctness stress test: a mix of readers, writers,
+ * upgraders and downgraders check that nobody ever sees a writer
+ * alongside anyone else, and that data written under the lock is
+ * never seen half-updated.
+ *
+ * rw2 measures read-side throughput with readers allowed to spread
+ * to 1, 2, ... N cpus.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NRWTHREADS	16
+#define NRWLOOPS	200
+#define NRWDATA		16
+#define NREADLOOPS	500
+#define READWORK	200
+
+static struct rwlock *testrw;
+static struct semaphore *donesem;
+
+/* Who is inside the lock right now, checked by the stress test. */
+static struct spinlock statelock = SPINLOCK_INITIALIZER;
+static unsigned activereaders;
+static unsigned activewriters;
+
+static volatile unsigned long testdata[NRWDATA];
+
+static
+void
+inititems(void)
+{
+	unsigned i;
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+	activereaders = activewriters = 0;
+	for (i=0; i<NRWDATA; i++) {
+		testdata[i] = 0;
+	}
+}
+
+static
+void
+cleanitems(void)
+{
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	sem_destroy(donesem);
+	donesem = NULL;
+}
+
+static
+void
+enter(unsigned long num, bool writer)
+{
+	spinlock_acquire(&statelock);
+	if (activewriters != 0 || (writer && activereaders != 0)) {
+		panic("rwtest: thread %lu: %s entered with %u readers, "
+		      "%u writers\n", num, writer ? "writer" : "reader",
+		      activereaders, activewriters);
+	}
+	if (writer) {
+		activewriters++;
+	}
+	else {
+		activereaders++;
+	}
+	spinlock_release(&statelock);
+}
+
+static
+void
+leave(bool writer)
+{
+	spinlock_acquire(&statelock);
+	if (writer) {
+		activewriters--;
+	}
+	else {
+		activereaders--;
+	}
+	spinlock_release(&statelock);
+}
+
+static
+void
+checkdata(unsigned long num)
+{
+	unsigned long val;
+	unsigned i;
+
+	val = testdata[0];
+	for (i=1; i<NRWDATA; i++) {
+		if (testdata[i] != val) {
+			panic("rwtest: thread %lu: torn data at %u: "
+			      "%lu vs %lu\n", num, i, testdata[i], val);
+		}
+	}
+}
+
+static
+void
+writedata(unsigned long num)
+{
+	unsigned i;
+
+	for (i=0; i<NRWDATA; i++) {
+		testdata[i] = num;
+		if (i == NRWDATA/2) {
+			/* give anyone who shouldn't be here a chance */
+			thread_yield();
+		}
+	}
+}
+
+static
+void
+rwstressthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		switch (random() % 8) {
+		    case 0:
+			/* plain writer */
+			rwlock_acquire_write(testrw);
+			enter(num, true);
+			writedata(num);
+			checkdata(num);
+			leave(true);
+			rwlock_release_write(testrw);
+			break;
+		    case 1:
+			/* writer, then downgrade and read back */
+			rwlock_acquire_write(testrw);
+			enter(num, true);
+			writedata(num);
+			leave(true);
+			rwlock_downgrade(testrw);
+			enter(num, false);
+			checkdata(num);
+			if (testdata[0] != num) {
+				panic("rwtest: thread %lu: writer got in "
+				      "during downgrade\n", num);
+			}
+			leave(false);
+			rwlock_release_read(testrw);
+			break;
+		    case 2:
+			/* reader, then try to upgrade */
+			rwlock_acquire_read(testrw);
+			enter(num, false);
+			checkdata(num);
+			leave(false);
+			if (rwlock_upgrade(testrw)) {
+				enter(num, true);
+				writedata(num);
+				checkdata(num);
+				leave(true);
+				rwlock_release_write(testrw);
+			}
+			else {
+				rwlock_release_read(testrw);
+			}
+			break;
+		    default:
+			/* plain reader */
+			rwlock_acquire_read(testrw);
+			enter(num, false);
+			checkdata(num);
+			thread_yield();
+			checkdata(num);
+			leave(false);
+			rwlock_release_read(testrw);
+			break;
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NRWTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwstressthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRWTHREADS; i++) {
+		P(donesem);
+	}
+
+	cleanitems();
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+static
+void
+rwreadthread(void *junk, unsigned long num)
+{
+	volatile unsigned long sum;
+	int i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NREADLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+		sum = 0;
+		for (j=0; j<READWORK; j++) {
+			sum += testdata[j % NRWDATA];
+		}
+		rwlock_release_read(testrw);
+	}
+	V(donesem);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned n, numcpus;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock read throughput test...\n");
+
+	numcpus = thread_numcpus();
+	for (n=1; n<=numcpus; n++) {
+		thread_setactivecpus(n);
+		gettime(&secs1, &nsecs1);
+		for (i=0; i<NRWTHREADS; i++) {
+			result = thread_fork("rwtest2", NULL, rwreadthread,
+					     NULL, i);
+			if (result) {
+				panic("rwtest2: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<NRWTHREADS; i++) {
+			P(donesem);
+		}
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+		kprintf("%u cpu%s: %d read acquires in %lu.%09lu seconds\n",
+			n, n == 1 ? "" : "s", NRWTHREADS * NREADLOOPS,
+			(unsigned long)secs2, (unsigned long)nsecs2);
+	}
+	thread_setactivecpus(numcpus);
+
+	cleanitems();
+	kprintf("Rwlock read throughput test done.\n");
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Spinlock microbenchmark.
+ *
+ * For each cpu count from 1 up to the number of cpus, one thread per
+ * cpu hammers on a single spinlock for a couple of seconds. We report
+ * total acquisitions per second (throughput) and the fewest and most
+ * acquisitions any one thread got (fairness).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define MAXSLTHREADS	32
+#define SLSECONDS	2
+
+static struct spinlock testspinlock = SPINLOCK_INITIALIZER;
+static struct semaphore *donesem;
+
+static volatile bool sl_go;
+static volatile bool sl_stop;
+static volatile unsigned long sl_shared;
+static unsigned long sl_counts[MAXSLTHREADS];
+
+static
+void
+slthread(void *junk, unsigned long num)
+{
+	unsigned long count;
+
+	(void)junk;
+
+	while (!sl_go) {
+		/* wait for everyone to be ready */
+	}
+
+	count = 0;
+	while (!sl_stop) {
+		spinlock_acquire(&testspinlock);
+		sl_shared++;
+		spinlock_release(&testspinlock);
+		count++;
+	}
+	sl_counts[num] = count;
+
+	V(donesem);
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned long total, min, max, ms;
+	unsigned n, i, numcpus;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("spinlocktest: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock test...\n");
+	kprintf("cpus  acquires/sec         min         max\n");
+
+	numcpus = thread_numcpus();
+	if (numcpus > MAXSLTHREADS) {
+		numcpus = MAXSLTHREADS;
+	}
+	for (n=1; n<=numcpus; n++) {
+		thread_setactivecpus(n);
+		sl_go = sl_stop = false;
+		for (i=0; i<n; i++) {
+			sl_counts[i] = 0;
+			result = thread_fork("spinlocktest", NULL, slthread,
+					     NULL, i);
+			if (result) {
+				panic("spinlocktest: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+
+		gettime(&secs1, &nsecs1);
+		sl_go = true;
+		clocksleep(SLSECONDS);
+		sl_stop = true;
+		gettime(&secs2, &nsecs2);
+
+		for (i=0; i<n; i++) {
+			P(donesem);
+		}
+
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+		ms = (unsigned long)secs2 * 1000 + nsecs2 / 1000000;
+		total = 0;
+		min = max = sl_counts[0];
+		for (i=0; i<n; i++) {
+			total += sl_counts[i];
+			if (sl_counts[i] < min) {
+				min = sl_counts[i];
+			}
+			if (sl_counts[i] > max) {
+				max = sl_counts[i];
+			}
+		}
+		kprintf("%4u  %12llu  %10lu  %10lu\n", n,
+			ms > 0 ? (unsigned long long)total * 1000 / ms : 0,
+			min, max);
+	}
+	thread_setactivecpus(thread_numcpus());
+
+	sem_destroy(donesem);
+	donesem = NULL;
+	kprintf("Spinlock test done.\n");
+
+	return 0;
+}
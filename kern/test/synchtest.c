@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -225,16 +226,34 @@ locktestthread(void *junk, unsigned long num)
 }
 
 
+/*
+ * Usage: sy2 [ncpus]
+ *
+ * With an argument, the test threads are only allowed to spread to
+ * that many cpus, for comparing lock throughput across cpu counts.
+ */
 int
 locktest(int nargs, char **args)
 {
 	int i, result;
+	unsigned ncpus;
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
 
-	(void)nargs;
-	(void)args;
+	ncpus = thread_numcpus();
+	if (nargs > 1) {
+		ncpus = atoi(args[1]);
+		if (ncpus < 1 || ncpus > thread_numcpus()) {
+			kprintf("Usage: sy2 [ncpus]\n");
+			return EINVAL;
+		}
+	}
+	thread_setactivecpus(ncpus);
 
 	inititems();
-	kprintf("Starting lock test...\n");
+	kprintf("Starting lock test on %u cpu%s...\n",
+		ncpus, ncpus == 1 ? "" : "s");
+	gettime(&secs1, &nsecs1);
 
 	for (i=0; i<NTHREADS; i++) {
 		result = thread_fork("synchtest", NULL, locktestthread,
@@ -247,11 +266,16 @@ locktest(int nargs, char **args)
 	for (i=0; i<NTHREADS; i++) {
 		P(donesem);
 	}
+	gettime(&secs2, &nsecs2);
+	thread_setactivecpus(thread_numcpus());
 
 #ifdef UW
   cleanitems();
 #endif
-	kprintf("Lock test done.\n");
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+	kprintf("Lock test done: %d acquires in %lu.%09lu seconds.\n",
+		NTHREADS * NLOCKLOOPS, (unsigned long)secs2,
+		(unsigned long)nsecs2);
 
 	return 0;
 }
@@ -0,0 +1,9 @@
+/*
+ * Atomic operations. See atomic.h.
+ */
+
+/* Make sure to build out-of-line versions of atomic inline functions */
+#define ATOMIC_INLINE	/* empty */
+
+#include <types.h>
+#include <atomic.h>
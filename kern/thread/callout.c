@@ -0,0 +1,293 @@
+/*
+ * Callouts. See callout.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <clock.h>
+#include <callout.h>
+#include <current.h>
+
+/* Ticks the whole wheel can reach. */
+#define CALLOUT_RANGE	((uint64_t)1 << (CALLOUT_LEVELS * CALLOUT_SLOTBITS))
+
+static
+void
+callout_link(struct callout **head, struct callout *co)
+{
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+static
+void
+callout_unlink(struct callout *co)
+{
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Put CO in the slot for its expiry time: the lowest level whose
+ * slots, counting forward from now, reach that far. Call with the
+ * wheel locked.
+ */
+static
+void
+callout_place(struct callout_wheel *cw, struct callout *co)
+{
+	uint64_t delta, when;
+	unsigned level, slot;
+
+	KASSERT(co->co_expire >= cw->cw_now);
+	when = co->co_expire;
+	delta = when - cw->cw_now;
+	if (delta >= CALLOUT_RANGE) {
+		/* Park it as far out as we can see; it'll come back. */
+		when = cw->cw_now + CALLOUT_RANGE - 1;
+		delta = CALLOUT_RANGE - 1;
+	}
+
+	for (level = 0; level < CALLOUT_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << ((level+1) * CALLOUT_SLOTBITS))) {
+			break;
+		}
+	}
+	slot = (when >> (level * CALLOUT_SLOTBITS)) & (CALLOUT_SLOTS - 1);
+	callout_link(&cw->cw_slots[level][slot], co);
+}
+
+void
+callout_wheel_init(struct callout_wheel *cw)
+{
+	unsigned level, slot;
+
+	spinlock_init(&cw->cw_lock);
+	cw->cw_now = 0;
+	for (level = 0; level < CALLOUT_LEVELS; level++) {
+		for (slot = 0; slot < CALLOUT_SLOTS; slot++) {
+			cw->cw_slots[level][slot] = NULL;
+		}
+	}
+	cw->cw_expired = NULL;
+	cw->cw_running = NULL;
+}
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_cpu = NULL;
+	co->co_pending = false;
+}
+
+void
+callout_cleanup(struct callout *co)
+{
+	KASSERT(!co->co_pending);
+}
+
+/*
+ * Take CO off whatever wheel it's on. If WAIT is set and its function
+ * is running on another cpu, wait for that to finish. Returns true if
+ * it was pending.
+ */
+static
+bool
+callout_stop(struct callout *co, bool wait)
+{
+	struct cpu *c;
+	struct callout_wheel *cw;
+
+ again:
+	c = co->co_cpu;
+	if (c == NULL) {
+		/* Never scheduled. */
+		return false;
+	}
+	cw = &c->c_callouts;
+
+	spinlock_acquire(&cw->cw_lock);
+	if (co->co_cpu != c) {
+		/* Rescheduled onto another cpu under us. */
+		spinlock_release(&cw->cw_lock);
+		goto again;
+	}
+	if (co->co_pending) {
+		callout_unlink(co);
+		co->co_pending = false;
+		spinlock_release(&cw->cw_lock);
+		return true;
+	}
+	if (wait && cw->cw_running == co) {
+		/* It can't be interrupting us, or we wouldn't be here. */
+		KASSERT(c != curcpu->c_self);
+		spinlock_release(&cw->cw_lock);
+		while (cw->cw_running == co) {
+			/* spin */
+		}
+		/* The function may have rescheduled it. */
+		goto again;
+	}
+	spinlock_release(&cw->cw_lock);
+	return false;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callout_wheel *cw;
+	int spl;
+
+	KASSERT(co->co_func != NULL);
+
+	callout_stop(co, false);
+
+	/* Stay on this cpu until it's on our wheel. */
+	spl = splhigh();
+	cw = &curcpu->c_callouts;
+	spinlock_acquire(&cw->cw_lock);
+	co->co_cpu = curcpu->c_self;
+	co->co_expire = cw->cw_now + (ticks > 0 ? ticks : 1);
+	co->co_pending = true;
+	callout_place(cw, co);
+	spinlock_release(&cw->cw_lock);
+	splx(spl);
+}
+
+/*
+ * Round up to whole ticks, plus one because the current tick is
+ * already partly over: the callout runs no sooner than NSECS from now.
+ */
+void
+callout_schedule_ns(struct callout *co, uint64_t nsecs)
+{
+	uint64_t ticks;
+
+	ticks = (nsecs / 1000000000) * HZ +
+		((nsecs % 1000000000) * HZ + 999999999) / 1000000000 + 1;
+	if (ticks > (unsigned)-1) {
+		ticks = (unsigned)-1;
+	}
+	callout_schedule(co, ticks);
+}
+
+bool
+callout_cancel(struct callout *co)
+{
+	return callout_stop(co, true);
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_pending;
+}
+
+/*
+ * Advance this cpu's wheel by one tick and run whatever is due.
+ * Called from hardclock.
+ */
+void
+callout_hardclock(void)
+{
+	struct callout_wheel *cw;
+	struct callout *co, *next;
+	void (*func)(void *);
+	void *arg;
+	unsigned level, slot;
+
+	cw = &curcpu->c_callouts;
+
+	spinlock_acquire(&cw->cw_lock);
+	cw->cw_now++;
+
+	/*
+	 * Each time a level wraps around, spread the next slot of the
+	 * level above it down into the lower levels.
+	 */
+	for (level = 1; level < CALLOUT_LEVELS; level++) {
+		if ((cw->cw_now &
+		     (((uint64_t)1 << (level * CALLOUT_SLOTBITS)) - 1)) != 0) {
+			break;
+		}
+		slot = (cw->cw_now >> (level * CALLOUT_SLOTBITS)) &
+			(CALLOUT_SLOTS - 1);
+		co = cw->cw_slots[level][slot];
+		cw->cw_slots[level][slot] = NULL;
+		while (co != NULL) {
+			next = co->co_next;
+			callout_place(cw, co);
+			co = next;
+		}
+	}
+
+	/*
+	 * Everything in the current bottom slot is due. Move it to the
+	 * expired list, where callout_cancel can still find it, and run
+	 * it from there without the wheel locked.
+	 */
+	slot = cw->cw_now & (CALLOUT_SLOTS - 1);
+	KASSERT(cw->cw_expired == NULL);
+	cw->cw_expired = cw->cw_slots[0][slot];
+	cw->cw_slots[0][slot] = NULL;
+	if (cw->cw_expired != NULL) {
+		cw->cw_expired->co_prevp = &cw->cw_expired;
+	}
+
+	while ((co = cw->cw_expired) != NULL) {
+		KASSERT(co->co_expire == cw->cw_now);
+		callout_unlink(co);
+		co->co_pending = false;
+		func = co->co_func;
+		arg = co->co_arg;
+		cw->cw_running = co;
+		spinlock_release(&cw->cw_lock);
+
+		func(arg);
+
+		spinlock_acquire(&cw->cw_lock);
+		cw->cw_running = NULL;
+	}
+	spinlock_release(&cw->cw_lock);
+}
+
+/*
+ * The wheel next needs attention when something in the bottom level
+ * comes due, or when the bottom level wraps and the next level is
+ * cascaded, whichever is first. That's never more than a full turn
+ * of the bottom level away.
+ */
+unsigned
+callout_idleticks(void)
+{
+	struct callout_wheel *cw;
+	unsigned ticks, slot;
+
+	cw = &curcpu->c_callouts;
+
+	spinlock_acquire(&cw->cw_lock);
+	for (ticks = 1; ticks < CALLOUT_SLOTS; ticks++) {
+		slot = (cw->cw_now + ticks) & (CALLOUT_SLOTS - 1);
+		if (slot == 0 || cw->cw_slots[0][slot] != NULL) {
+			break;
+		}
+	}
+	spinlock_release(&cw->cw_lock);
+
+	return ticks;
+}
@@ -28,19 +28,23 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <callout.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks at specific points in the future are handled by the
+ * callouts in callout.c, which hardclock drives; sleeping for less
+ * than a second is built on them.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,7 +54,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	50	/* Age run queues every 50 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -58,16 +62,31 @@
  */
 static struct wchan *lbolt;
 
+/*
+ * Threads in clocksleep_ns wait on one of these, picked by hashing
+ * the thread, so a wakeup only disturbs the few that share a channel.
+ */
+#define SLEEPQ_SIZE	16
+static struct wchan *sleepq[SLEEPQ_SIZE];
+
 /*
  * Setup.
  */
 void
 hardclock_bootstrap(void)
 {
+	unsigned i;
+
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	for (i = 0; i < SLEEPQ_SIZE; i++) {
+		sleepq[i] = wchan_create("sleepq");
+		if (sleepq[i] == NULL) {
+			panic("Couldn't create sleepq\n");
+		}
+	}
 }
 
 /*
@@ -81,25 +100,146 @@ timerclock(void)
 	wchan_wakeall(lbolt);
 }
 
+/*
+ * Tickless idle.
+ *
+ * Most hardclocks on an idle cpu have nothing to do. So before idling,
+ * a cpu defers its next hardclock until its callout wheel next needs
+ * to advance. Whatever wakes it up, the ticks it skipped are then
+ * made up (advancing the wheel, and running any callouts that came
+ * due, all at once) and periodic hardclocks resume.
+ */
+static bool tickless_enabled;		/* Set once gettime works */
+static volatile int tickless_cpus;	/* Number of cpus with c_tickless */
+
+/*
+ * Turn tickless idle on. This must wait until the clock used by
+ * gettime() has been configured.
+ */
+void
+hardclock_tickless_bootstrap(void)
+{
+	tickless_enabled = true;
+}
+
+uint64_t
+clock_nsecs(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Leave tickless mode. Returns the number of whole ticks that went by.
+ */
+static
+unsigned
+hardclock_endtickless(void)
+{
+	uint64_t elapsed;
+
+	KASSERT(curcpu->c_tickless);
+	curcpu->c_tickless = false;
+	atomic_dec(&tickless_cpus);
+
+	elapsed = clock_nsecs() - curcpu->c_tickless_start;
+	return elapsed * HZ / 1000000000;
+}
+
+/*
+ * Account for TICKS hardclocks we didn't take.
+ */
+static
+void
+hardclock_catchup(unsigned ticks)
+{
+	while (ticks > 0) {
+		curcpu->c_hardclocks++;
+		callout_hardclock();
+		ticks--;
+	}
+}
+
+/*
+ * Called by the idle loop, with interrupts off, just before idling.
+ */
+void
+hardclock_idle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (!tickless_enabled || curcpu->c_tickless) {
+		return;
+	}
+	ticks = callout_idleticks();
+	if (ticks <= 1) {
+		return;
+	}
+
+	curcpu->c_tickless_start = clock_nsecs();
+	curcpu->c_tickless = true;
+	atomic_inc(&tickless_cpus);
+	mainbus_set_hardclock(ticks);
+}
+
+/*
+ * Called by the idle loop, with interrupts off, after waking up.
+ */
+void
+hardclock_unidle(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_tickless) {
+		mainbus_set_hardclock(1);
+		hardclock_catchup(hardclock_endtickless());
+	}
+}
+
+/*
+ * True if any cpu is idle with its hardclock deferred, and so won't
+ * notice work waiting elsewhere until it's told.
+ */
+bool
+hardclock_anytickless(void)
+{
+	return tickless_cpus > 0;
+}
+
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except while the processor is tickless.
  */
 void
 hardclock(void)
 {
+	unsigned skipped;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
+	if (curcpu->c_tickless) {
+		/* Our deferred tick; make up the others first. */
+		skipped = hardclock_endtickless();
+		hardclock_catchup(skipped > 0 ? skipped - 1 : 0);
+	}
+
 	curcpu->c_hardclocks++;
+	callout_hardclock();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	/* Preempt if the quantum is up (see SCHED_QUANTUM in cpu.h). */
+	thread_tick();
 }
 
 /*
@@ -114,3 +254,81 @@ clocksleep(int num_secs)
 		num_secs--;
 	}
 }
+
+struct clocksleeper {
+	struct callout cs_callout;
+	struct wchan *cs_wchan;
+	volatile bool cs_done;
+};
+
+static
+void
+clocksleep_wakeup(void *data)
+{
+	struct clocksleeper *cs = data;
+
+	cs->cs_done = true;
+	wchan_wakeall(cs->cs_wchan);
+}
+
+/*
+ * Suspend execution for at least NSECS nanoseconds, or until *STOP
+ * (if STOP isn't NULL) is set and clocksleep_interrupt is called.
+ * Returns EINTR in the latter case.
+ */
+int
+clocksleep_ns_intr(uint64_t nsecs, volatile bool *stop)
+{
+	struct clocksleeper cs;
+	int result = 0;
+
+	if (nsecs == 0) {
+		return 0;
+	}
+
+	cs.cs_wchan = sleepq[((uintptr_t)curthread >> 6) % SLEEPQ_SIZE];
+	cs.cs_done = false;
+	callout_init(&cs.cs_callout, clocksleep_wakeup, &cs);
+	callout_schedule_ns(&cs.cs_callout, nsecs);
+
+	/*
+	 * Check cs_done with the wchan locked, so the wakeup can't get
+	 * in between the check and going to sleep.
+	 */
+	wchan_lock(cs.cs_wchan);
+	while (!cs.cs_done) {
+		if (stop != NULL && *stop) {
+			result = EINTR;
+			break;
+		}
+		wchan_sleep(cs.cs_wchan);
+		wchan_lock(cs.cs_wchan);
+	}
+	wchan_unlock(cs.cs_wchan);
+
+	/* Make sure the callout is finished with cs before it goes away. */
+	callout_cancel(&cs.cs_callout);
+	callout_cleanup(&cs.cs_callout);
+	return result;
+}
+
+void
+clocksleep_ns(uint64_t nsecs)
+{
+	clocksleep_ns_intr(nsecs, NULL);
+}
+
+/*
+ * Wake everyone in clocksleep_ns_intr to check their stop flags. We
+ * don't know which queue the ones that care are on, but this is rare
+ * enough (see uthread_exit) that waking the rest spuriously is fine.
+ */
+void
+clocksleep_interrupt(void)
+{
+	unsigned i;
+
+	for (i = 0; i < SLEEPQ_SIZE; i++) {
+		wchan_wakeall(sleepq[i]);
+	}
+}
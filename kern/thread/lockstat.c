@@ -0,0 +1,271 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+/* Size of the statistics table; must be a power of 2. */
+#define LOCKSTAT_MAX		512
+#define LOCKSTAT_NAMELEN	24
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];	/* Lock name; empty if unused */
+	const void *ls_callsite;	/* Where the acquire was called */
+	unsigned long ls_acquires;	/* Number of acquisitions */
+	unsigned long ls_contended;	/* ...that had to wait */
+	uint64_t ls_totalwait;		/* Wait time, in ns */
+	uint64_t ls_maxwait;
+	uint64_t ls_totalhold;		/* Hold time, in ns */
+	uint64_t ls_maxhold;
+};
+
+static struct lockstat lockstat_table[LOCKSTAT_MAX];
+static unsigned long lockstat_dropped;	/* Acquires with no room to record */
+static volatile bool lockstat_enabled;
+
+/*
+ * The table is protected by a raw spin word rather than a struct
+ * spinlock, since spinlock_acquire itself records into the table.
+ * Interrupts are kept off while it's held, so an interrupt handler
+ * taking a lock on this cpu can't deadlock against us.
+ */
+static volatile spinlock_data_t lockstat_lock = SPINLOCK_DATA_INITIALIZER;
+
+static
+int
+lockstat_lock_acquire(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockstat_lock) != 0 ||
+	       spinlock_data_testandset(&lockstat_lock) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockstat_lock_release(int spl)
+{
+	spinlock_data_set(&lockstat_lock, 0);
+	splx(spl);
+}
+
+void
+lockstat_bootstrap(void)
+{
+	lockstat_enabled = true;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	if (!lockstat_enabled) {
+		return 0;
+	}
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Compare NAME against an entry's name, which may have been
+ * truncated to fit.
+ */
+static
+bool
+lockstat_namematch(const struct lockstat *ls, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKSTAT_NAMELEN - 1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find (or create) the entry for NAME and CALLSITE. Call with the
+ * table locked. Returns NULL if the table is full.
+ */
+static
+struct lockstat *
+lockstat_lookup(const char *name, const void *callsite)
+{
+	struct lockstat *ls;
+	unsigned hash, i, j;
+	const char *s;
+
+	hash = (uintptr_t)callsite >> 2;
+	for (s = name; *s != 0; s++) {
+		hash = hash * 33 + (unsigned char)*s;
+	}
+
+	for (i = 0; i < LOCKSTAT_MAX; i++) {
+		ls = &lockstat_table[(hash + i) & (LOCKSTAT_MAX - 1)];
+		if (ls->ls_name[0] == 0) {
+			for (j = 0; j < LOCKSTAT_NAMELEN - 1 && name[j]; j++) {
+				ls->ls_name[j] = name[j];
+			}
+			ls->ls_name[j] = 0;
+			ls->ls_callsite = callsite;
+			return ls;
+		}
+		if (ls->ls_callsite == callsite &&
+		    lockstat_namematch(ls, name)) {
+			return ls;
+		}
+	}
+	return NULL;
+}
+
+struct lockstat *
+lockstat_acquired(const char *name, const void *callsite,
+		  bool contended, uint64_t waitstart, uint64_t *acqtime)
+{
+	struct lockstat *ls;
+	uint64_t now, wait;
+	int spl;
+
+	if (!lockstat_enabled || waitstart == 0 || name[0] == 0) {
+		*acqtime = 0;
+		return NULL;
+	}
+
+	now = lockstat_now();
+	wait = now - waitstart;
+	*acqtime = now;
+
+	spl = lockstat_lock_acquire();
+	ls = lockstat_lookup(name, callsite);
+	if (ls == NULL) {
+		lockstat_dropped++;
+	}
+	else {
+		ls->ls_acquires++;
+		if (contended) {
+			ls->ls_contended++;
+		}
+		ls->ls_totalwait += wait;
+		if (wait > ls->ls_maxwait) {
+			ls->ls_maxwait = wait;
+		}
+	}
+	lockstat_lock_release(spl);
+
+	return ls;
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64_t acqtime)
+{
+	uint64_t hold;
+	int spl;
+
+	if (ls == NULL || acqtime == 0) {
+		return;
+	}
+
+	hold = lockstat_now() - acqtime;
+
+	spl = lockstat_lock_acquire();
+	ls->ls_totalhold += hold;
+	if (hold > ls->ls_maxhold) {
+		ls->ls_maxhold = hold;
+	}
+	lockstat_lock_release(spl);
+}
+
+/*
+ * Clear the counters. The entries themselves stay, because locks
+ * held right now still point at them.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	unsigned i;
+	int spl;
+
+	spl = lockstat_lock_acquire();
+	for (i = 0; i < LOCKSTAT_MAX; i++) {
+		ls = &lockstat_table[i];
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_totalwait = 0;
+		ls->ls_maxwait = 0;
+		ls->ls_totalhold = 0;
+		ls->ls_maxhold = 0;
+	}
+	lockstat_dropped = 0;
+	lockstat_lock_release(spl);
+}
+
+void
+lockstat_print(void)
+{
+	struct lockstat *snap, *ls, tmp;
+	unsigned long dropped;
+	unsigned i, j, num;
+	int spl;
+
+	/*
+	 * Copy the table so we aren't printing (and sorting) with it
+	 * locked. Allocate first: kmalloc takes spinlocks.
+	 */
+	snap = kmalloc(sizeof(lockstat_table));
+	if (snap == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+	spl = lockstat_lock_acquire();
+	num = 0;
+	for (i = 0; i < LOCKSTAT_MAX; i++) {
+		if (lockstat_table[i].ls_acquires > 0) {
+			snap[num++] = lockstat_table[i];
+		}
+	}
+	dropped = lockstat_dropped;
+	lockstat_lock_release(spl);
+
+	/* Sort by total wait, largest first. */
+	for (i = 1; i < num; i++) {
+		tmp = snap[i];
+		for (j = i; j > 0 &&
+			     snap[j-1].ls_totalwait < tmp.ls_totalwait; j--) {
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-23s %-10s %8s %8s %10s %8s %10s %8s\n",
+		"name", "callsite", "acquires", "contend",
+		"wait(us)", "maxwait", "hold(us)", "maxhold");
+	for (i = 0; i < num; i++) {
+		ls = &snap[i];
+		kprintf("%-23s %10p %8lu %8lu %10llu %8llu %10llu %8llu\n",
+			ls->ls_name, ls->ls_callsite,
+			ls->ls_acquires, ls->ls_contended,
+			ls->ls_totalwait / 1000, ls->ls_maxwait / 1000,
+			ls->ls_totalhold / 1000, ls->ls_maxhold / 1000);
+	}
+	if (dropped > 0) {
+		kprintf("(%lu acquires not recorded: table full)\n", dropped);
+	}
+
+	kfree(snap);
+}
@@ -0,0 +1,136 @@
+/*
+ * Scheduling statistics. See schedstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <schedstat.h>
+
+static volatile bool schedstat_enabled;
+
+void
+schedstat_bootstrap(void)
+{
+	schedstat_enabled = true;
+}
+
+uint64_t
+schedstat_now(void)
+{
+	if (!schedstat_enabled) {
+		return 0;
+	}
+	return clock_nsecs();
+}
+
+void
+schedstat_record(struct schedhist *sh, uint64_t ns)
+{
+	unsigned b;
+
+	b = 0;
+	while (b < SCHEDSTAT_BUCKETS - 1 && (ns >> (b + 1)) != 0) {
+		b++;
+	}
+	sh->sh_count[b]++;
+	sh->sh_total += ns;
+	if (ns > sh->sh_max) {
+		sh->sh_max = ns;
+	}
+}
+
+void
+schedstat_reset(struct schedstat *ss)
+{
+	bzero(ss, sizeof(*ss));
+}
+
+/* Histograms, for schedstat_printhist. */
+#define SH_RQWAIT	0
+#define SH_SWITCH	1
+#define SH_IDLE		2
+
+static
+const struct schedhist *
+schedstat_hist(const struct schedstat *ss, unsigned which)
+{
+	switch (which) {
+	    case SH_RQWAIT: return &ss->ss_rqwait;
+	    case SH_SWITCH: return &ss->ss_switch;
+	    case SH_IDLE: return &ss->ss_idle;
+	}
+	panic("schedstat: bad histogram %u\n", which);
+}
+
+/*
+ * Print one histogram, a column per cpu. Only buckets that some cpu
+ * has counts in are shown, labeled by their lower bound.
+ */
+static
+void
+schedstat_printhist(const char *name, struct schedstat *const *stats,
+		    unsigned num, unsigned which)
+{
+	const struct schedhist *sh;
+	unsigned b, i;
+	bool any;
+	uint32_t n;
+
+	kprintf("%s (ns):\n", name);
+	kprintf("%12s", ">=");
+	for (i = 0; i < num; i++) {
+		kprintf("  %8s%-2u", "cpu", i);
+	}
+	kprintf("\n");
+
+	for (b = 0; b < SCHEDSTAT_BUCKETS; b++) {
+		any = false;
+		for (i = 0; i < num; i++) {
+			sh = schedstat_hist(stats[i], which);
+			if (sh->sh_count[b] != 0) {
+				any = true;
+			}
+		}
+		if (!any) {
+			continue;
+		}
+		kprintf("%12llu", b == 0 ? 0ULL : 1ULL << b);
+		for (i = 0; i < num; i++) {
+			sh = schedstat_hist(stats[i], which);
+			kprintf("  %10u", sh->sh_count[b]);
+		}
+		kprintf("\n");
+	}
+
+	kprintf("%12s", "avg");
+	for (i = 0; i < num; i++) {
+		sh = schedstat_hist(stats[i], which);
+		n = 0;
+		for (b = 0; b < SCHEDSTAT_BUCKETS; b++) {
+			n += sh->sh_count[b];
+		}
+		kprintf("  %10llu", n > 0 ? sh->sh_total / n : 0ULL);
+	}
+	kprintf("\n%12s", "max");
+	for (i = 0; i < num; i++) {
+		sh = schedstat_hist(stats[i], which);
+		kprintf("  %10llu", sh->sh_max);
+	}
+	kprintf("\n");
+}
+
+void
+schedstat_print(struct schedstat *const *stats, unsigned num)
+{
+	unsigned i;
+
+	kprintf("cpu   voluntary  involuntary\n");
+	for (i = 0; i < num; i++) {
+		kprintf("%3u  %10u  %11u\n", i,
+			stats[i]->ss_voluntary, stats[i]->ss_involuntary);
+	}
+	schedstat_printhist("Run queue wait", stats, num, SH_RQWAIT);
+	schedstat_printhist("Switch time", stats, num, SH_SWITCH);
+	schedstat_printhist("Idle periods", stats, num, SH_IDLE);
+}
@@ -36,11 +36,23 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
+#include <splstat.h>
+#include "opt-spinbackoff.h"
 
 /*
  * Spinlocks.
  */
 
+#if OPT_SPINBACKOFF
+/*
+ * Bounds, in loop iterations, on how long a waiting cpu waits between
+ * looks at the lock. The delay doubles after each look up to the max.
+ */
+#define SPINLOCK_BACKOFF_MIN	4
+#define SPINLOCK_BACKOFF_MAX	1024
+#endif
+
 
 /*
  * Initialize spinlock.
@@ -48,8 +60,13 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lk->lk_stat = NULL;
+	lk->lk_acqtime = 0;
+#endif
 }
 
 /*
@@ -59,7 +76,8 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
 /*
@@ -67,14 +85,26 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to come up.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_SPINBACKOFF
+	volatile unsigned i;
+	unsigned delay;
+#endif
+#if OPT_LOCKSTAT
+	uint64_t waitstart;
+	bool contended;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
+#if OPT_SPLSTAT
+	splstat_irqoff(__builtin_return_address(0));
+#endif
 
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
@@ -87,27 +117,39 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+	/*
+	 * Fetch-and-increment is a machine-level atomic operation, so
+	 * every cpu gets a different ticket. Tickets are served in
+	 * order, which keeps any one cpu from being starved. While
+	 * waiting we only read, so the cache line isn't bounced
+	 * around until the holder releases.
+	 */
+	ticket = spinlock_data_fetchinc(&lk->lk_next);
+#if OPT_LOCKSTAT
+	waitstart = lockstat_now();
+	contended = spinlock_data_get(&lk->lk_serving) != ticket;
+#endif
+#if OPT_SPINBACKOFF
+	delay = SPINLOCK_BACKOFF_MIN;
+#endif
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+#if OPT_SPINBACKOFF
+		for (i=0; i<delay; i++) {
+			/* nothing */
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+		if (delay < SPINLOCK_BACKOFF_MAX) {
+			delay *= 2;
 		}
-		break;
+#endif
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	lk->lk_stat = lockstat_acquired(LOCKSTAT_SPINLOCK,
+					__builtin_return_address(0),
+					contended, waitstart,
+					&lk->lk_acqtime);
+#endif
 }
 
 /*
@@ -121,8 +163,14 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(lk->lk_stat, lk->lk_acqtime);
+#endif
+
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	/* Only the holder writes lk_serving, so no atomic op is needed. */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <splstat.h>
 
 /*
  * Machine-independent interrupt handling functions.
@@ -117,6 +118,9 @@ spllower(int oldspl, int newspl)
 		return;
 	}
 
+#if OPT_SPLSTAT
+	splstat_irqon();
+#endif
 	cur->t_iplhigh_count--;
 	if (cur->t_iplhigh_count == 0) {
 		cpu_irqon();
@@ -139,6 +143,9 @@ splx(int spl)
 		splraise(cur->t_curspl, spl);
 		ret = cur->t_curspl;
 		cur->t_curspl = spl;
+#if OPT_SPLSTAT
+		splstat_irqoff(__builtin_return_address(0));
+#endif
 	}
 	else if (cur->t_curspl > spl) {
 		/* turning interrupts on */
@@ -0,0 +1,199 @@
+/*
+ * Interrupts-off latency tracing. See splstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <spinlock.h>
+#include <splstat.h>
+
+/* Size of the statistics table; must be a power of 2. */
+#define SPLSTAT_MAX	256
+
+struct splstat {
+	const void *sp_callsite;	/* Who turned interrupts off; NULL if unused */
+	unsigned long sp_count;		/* Number of sections */
+	uint64_t sp_total;		/* Time with interrupts off, in ns */
+	uint64_t sp_max;
+};
+
+static struct splstat splstat_table[SPLSTAT_MAX];
+static unsigned long splstat_dropped;	/* Sections with no room to record */
+static volatile bool splstat_enabled;
+
+/*
+ * Taking this with interrupts already off doesn't start a new
+ * section, so recording under it doesn't recurse.
+ */
+static struct spinlock splstat_lock = SPINLOCK_INITIALIZER;
+
+void
+splstat_bootstrap(void)
+{
+	splstat_enabled = true;
+}
+
+uint64_t
+splstat_now(void)
+{
+	if (!splstat_enabled) {
+		return 0;
+	}
+	return clock_nsecs();
+}
+
+void
+splstat_irqoff(const void *callsite)
+{
+	if (!splstat_enabled || !CURCPU_EXISTS() ||
+	    curthread->t_iplhigh_count != 1) {
+		return;
+	}
+	/* clock_nsecs raises the IPL again, which doesn't count */
+	curcpu->c_irqoff_start = clock_nsecs();
+	curcpu->c_irqoff_idle = 0;
+	curcpu->c_irqoff_site = callsite;
+}
+
+/*
+ * Find (or create) the entry for CALLSITE. Call with the table
+ * locked. Returns NULL if the table is full.
+ */
+static
+struct splstat *
+splstat_lookup(const void *callsite)
+{
+	struct splstat *sp;
+	unsigned hash, i;
+
+	hash = (uintptr_t)callsite >> 2;
+	for (i = 0; i < SPLSTAT_MAX; i++) {
+		sp = &splstat_table[(hash + i) & (SPLSTAT_MAX - 1)];
+		if (sp->sp_callsite == NULL) {
+			sp->sp_callsite = callsite;
+			return sp;
+		}
+		if (sp->sp_callsite == callsite) {
+			return sp;
+		}
+	}
+	return NULL;
+}
+
+void
+splstat_irqon(void)
+{
+	struct splstat *sp;
+	uint64_t start, len;
+
+	if (!splstat_enabled || !CURCPU_EXISTS() ||
+	    curthread->t_iplhigh_count != 1) {
+		return;
+	}
+	start = curcpu->c_irqoff_start;
+	if (start == 0) {
+		/* began before we were enabled */
+		return;
+	}
+	curcpu->c_irqoff_start = 0;
+	len = clock_nsecs() - start - curcpu->c_irqoff_idle;
+
+	spinlock_acquire(&splstat_lock);
+	sp = splstat_lookup(curcpu->c_irqoff_site);
+	if (sp == NULL) {
+		splstat_dropped++;
+	}
+	else {
+		sp->sp_count++;
+		sp->sp_total += len;
+		if (len > sp->sp_max) {
+			sp->sp_max = len;
+		}
+	}
+	spinlock_release(&splstat_lock);
+}
+
+void
+splstat_idle(uint64_t idlestart)
+{
+	if (idlestart == 0 || curcpu->c_irqoff_start == 0) {
+		return;
+	}
+	curcpu->c_irqoff_idle += clock_nsecs() - idlestart;
+}
+
+/*
+ * Clear the counters. The entries themselves stay; there's no harm
+ * in keeping call sites around.
+ */
+void
+splstat_reset(void)
+{
+	struct splstat *sp;
+	unsigned i;
+
+	spinlock_acquire(&splstat_lock);
+	for (i = 0; i < SPLSTAT_MAX; i++) {
+		sp = &splstat_table[i];
+		sp->sp_count = 0;
+		sp->sp_total = 0;
+		sp->sp_max = 0;
+	}
+	splstat_dropped = 0;
+	spinlock_release(&splstat_lock);
+}
+
+void
+splstat_print(void)
+{
+	struct splstat *snap, *sp, tmp;
+	unsigned long dropped;
+	unsigned i, j, num;
+
+	/*
+	 * Copy the table so we aren't printing (and sorting) with it
+	 * locked, which would itself be a long interrupts-off section.
+	 */
+	snap = kmalloc(sizeof(splstat_table));
+	if (snap == NULL) {
+		kprintf("splstat: Out of memory\n");
+		return;
+	}
+	spinlock_acquire(&splstat_lock);
+	num = 0;
+	for (i = 0; i < SPLSTAT_MAX; i++) {
+		if (splstat_table[i].sp_count > 0) {
+			snap[num++] = splstat_table[i];
+		}
+	}
+	dropped = splstat_dropped;
+	spinlock_release(&splstat_lock);
+
+	/* Sort by longest section, largest first. */
+	for (i = 1; i < num; i++) {
+		tmp = snap[i];
+		for (j = i; j > 0 && snap[j-1].sp_max < tmp.sp_max; j--) {
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-10s %10s %10s %10s %10s\n",
+		"callsite", "count", "total(us)", "avg(ns)", "max(ns)");
+	for (i = 0; i < num; i++) {
+		sp = &snap[i];
+		kprintf("%10p %10lu %10llu %10llu %10llu\n",
+			sp->sp_callsite, sp->sp_count,
+			sp->sp_total / 1000, sp->sp_total / sp->sp_count,
+			sp->sp_max);
+	}
+	if (dropped > 0) {
+		kprintf("(%lu sections not recorded: table full)\n", dropped);
+	}
+
+	kfree(snap);
+}
@@ -39,6 +39,13 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+
+/*
+ * Maximum number of times lock_acquire polls a lock whose holder is
+ * running on another cpu before giving up and going to sleep.
+ */
+#define LOCK_SPIN_MAX	1000
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +78,9 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+        sem->sem_waiters = 0;
+        sem->sem_handoffs = 0;
+        sem->sem_fifo = false;
 
         return sem;
 }
@@ -90,6 +100,11 @@ sem_destroy(struct semaphore *sem)
 void 
 P(struct semaphore *sem)
 {
+#if OPT_LOCKSTAT
+        uint64_t waitstart;
+        bool contended;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -101,32 +116,45 @@ P(struct semaphore *sem)
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&sem->sem_lock);
-        while (sem->sem_count == 0) {
+#if OPT_LOCKSTAT
+	waitstart = lockstat_now();
+	contended = sem->sem_count == 0;
+#endif
+        while (sem->sem_count == 0 || (sem->sem_fifo && sem->sem_waiters > 0)) {
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
 		 * along in V right this instant the wakeup can't go
 		 * through on the wchan until we've finished going to
 		 * sleep. Note that wchan_sleep unlocks the wchan.
 		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * Unless sem_fifo is set, we don't maintain strict
+		 * FIFO ordering of threads going through the
+		 * semaphore; that is, we might "get" it on the first
+		 * try even if other threads are waiting. With
+		 * sem_fifo, newcomers queue behind any waiters and V
+		 * hands its unit directly to the first of them.
 		 */
+		sem->sem_waiters++;
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
                 wchan_sleep(sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
+		if (sem->sem_handoffs > 0) {
+			/* V gave us its unit; the count never went up. */
+			sem->sem_handoffs--;
+			goto done;
+		}
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
+ done:
 	spinlock_release(&sem->sem_lock);
+#if OPT_LOCKSTAT
+	/* Semaphores have no owner, so only the wait is recorded. */
+	lockstat_acquired(sem->sem_name, __builtin_return_address(0),
+			  contended, waitstart, &waitstart);
+#endif
 }
 
 void
@@ -136,13 +164,39 @@ V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	/*
+	 * P counts itself in sem_waiters before it goes to sleep, so if
+	 * there are none we can skip the wait channel entirely.
+	 */
+	if (sem->sem_waiters == 0) {
+		sem->sem_count++;
+		KASSERT(sem->sem_count > 0);
+	}
+	else if (sem->sem_fifo) {
+		sem->sem_waiters--;
+		sem->sem_handoffs++;
+		wchan_wakeone(sem->sem_wchan);
+	}
+	else {
+		sem->sem_waiters--;
+		sem->sem_count++;
+		KASSERT(sem->sem_count > 0);
+		wchan_wakeone(sem->sem_wchan);
+	}
 
 	spinlock_release(&sem->sem_lock);
 }
 
+void
+sem_setfifo(struct semaphore *sem, bool fifo)
+{
+        KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+	sem->sem_fifo = fifo;
+	spinlock_release(&sem->sem_lock);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
@@ -174,6 +228,13 @@ lock_create(const char *name)
 
         // no thread is currently holding this lock
         lock->lk_holder_thread = NULL;
+        lock->lk_waiters = 0;
+        lock->lk_fifo = true;
+        lock->lk_handoff = false;
+#if OPT_LOCKSTAT
+        lock->lk_stat = NULL;
+        lock->lk_acqtime = 0;
+#endif
 
         return lock;
 }
@@ -182,6 +243,7 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+        KASSERT(lock->lk_waiters == 0);
 
         spinlock_cleanup(&lock->lk_spinlock);
 		wchan_destroy(lock->lk_wchan);
@@ -190,30 +252,113 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Spin until LOCK is no longer held by HOLDER, HOLDER stops running,
+ * or we run out of patience. Called without the lock's spinlock so
+ * the holder can get in to release it.
+ */
+static
 void
-lock_acquire(struct lock *lock)
+lock_spin(struct lock *lock, volatile struct thread *holder)
 {
-        KASSERT(lock != NULL);
+        unsigned spins;
+
+        for (spins = 0; spins < LOCK_SPIN_MAX; spins++) {
+            if (lock->lk_holder_thread != holder ||
+                !thread_isrunning((const struct thread *)holder)) {
+                break;
+            }
+        }
+}
+
+/*
+ * Get LOCK, waiting as needed. Either it is free, or it is held by
+ * someone else, or lock_release has already handed it to us (we were
+ * moved onto its wait channel by a cv, or slept here); lk_handoff
+ * tells the last case apart from a thread taking a lock it holds,
+ * which lock_acquire has already ruled out.
+ */
+static
+void
+lock_get(struct lock *lock, const void *callsite)
+{
+        bool spun;
+#if OPT_LOCKSTAT
+        uint64_t waitstart;
+        bool contended;
+#else
+        (void)callsite;
+#endif
+
         KASSERT(curthread->t_in_interrupt == false);
 
         spinlock_acquire(&lock->lk_spinlock);
+#if OPT_LOCKSTAT
+        waitstart = lockstat_now();
+        contended = lock->lk_holder_thread != NULL;
+#endif
 
-        // lock is currently being held
+        spun = false;
         while (lock->lk_holder_thread != NULL) {
 
+            if (lock->lk_holder_thread == curthread) {
+                // lock_release handed it to us while we slept
+                KASSERT(lock->lk_handoff);
+                break;
+            }
+
+            // If the holder is running on another cpu it will likely
+            // release the lock soon; spinning for a bit is cheaper than
+            // two context switches.
+            if (!spun) {
+                volatile struct thread *holder = lock->lk_holder_thread;
+
+                spun = true;
+                spinlock_release(&lock->lk_spinlock);
+                lock_spin(lock, holder);
+                spinlock_acquire(&lock->lk_spinlock);
+                continue;
+            }
+
+            // Count ourselves as a waiter before sleeping, then look
+            // again: lock_release's fast path doesn't take lk_spinlock,
+            // so it may have let go since we checked. Either we see its
+            // store to lk_holder_thread here or it sees our count.
+            lock->lk_waiters++;
             wchan_lock(lock->lk_wchan);
+            if (lock->lk_holder_thread == NULL) {
+                lock->lk_waiters--;
+                wchan_unlock(lock->lk_wchan);
+                continue;
+            }
             spinlock_release(&lock->lk_spinlock);
             wchan_sleep(lock->lk_wchan); // thread is now unblocked
 
             spinlock_acquire(&lock->lk_spinlock);
+            spun = false;
         }
 
-        KASSERT(lock->lk_holder_thread == NULL);
-
         // This thread now holds this lock
         lock->lk_holder_thread = curthread;
+        lock->lk_handoff = false;
 
         spinlock_release(&lock->lk_spinlock);
+
+#if OPT_LOCKSTAT
+        lock->lk_stat = lockstat_acquired(lock->lk_name, callsite,
+                                          contended, waitstart,
+                                          &lock->lk_acqtime);
+#endif
+}
+
+void
+lock_acquire(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+        // not recursive
+        KASSERT(!lock_do_i_hold(lock));
+
+        lock_get(lock, __builtin_return_address(0));
 }
 
 void
@@ -221,16 +366,63 @@ lock_release(struct lock *lock)
 {
         // only the thread holding it can release
         KASSERT(lock_do_i_hold(lock));
+        KASSERT(!lock->lk_handoff);
+
+#if OPT_LOCKSTAT
+        lockstat_released(lock->lk_stat, lock->lk_acqtime);
+#endif
+
+        // Uncontended: a single store. If a thread registered as a
+        // waiter in the meantime, it either saw the store (and took
+        // the lock) or we see its count and fall into the slow path.
+        if (lock->lk_waiters == 0) {
+            lock->lk_holder_thread = NULL;
+            if (lock->lk_waiters == 0) {
+                return;
+            }
+        }
 
         spinlock_acquire(&lock->lk_spinlock);
 
-            wchan_wakeone(lock->lk_wchan);
-            
+        if (lock->lk_holder_thread != NULL &&
+            lock->lk_holder_thread != curthread) {
+            // Released by the fast path above and someone has since
+            // taken it; they'll wake the waiters.
+            spinlock_release(&lock->lk_spinlock);
+            return;
+        }
+
+        if (lock->lk_waiters == 0) {
             lock->lk_holder_thread = NULL;
+        }
+        else if (lock->lk_fifo) {
+            // Hand the lock straight to the first waiter so nobody
+            // can barge in ahead of it. It can't look at
+            // lk_holder_thread until we drop lk_spinlock.
+            lock->lk_waiters--;
+            lock->lk_holder_thread = wchan_handoff(lock->lk_wchan);
+            KASSERT(lock->lk_holder_thread != NULL);
+            lock->lk_handoff = true;
+        }
+        else {
+            lock->lk_waiters--;
+            lock->lk_holder_thread = NULL;
+            wchan_wakeone(lock->lk_wchan);
+        }
 
         spinlock_release(&lock->lk_spinlock);
 }
 
+void
+lock_setfifo(struct lock *lock, bool fifo)
+{
+        KASSERT(lock != NULL);
+
+        spinlock_acquire(&lock->lk_spinlock);
+        lock->lk_fifo = fifo;
+        spinlock_release(&lock->lk_spinlock);
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -282,6 +474,22 @@ cv_destroy(struct cv *cv)
         kfree(cv);
 }
 
+/*
+ * Count threads just moved onto LOCK's wait channel as its waiters,
+ * so that lock_release takes the slow path and wakes them. We hold
+ * LOCK, so it can't be released in between.
+ */
+static
+void
+cv_addwaiters(struct lock *lock, unsigned moved)
+{
+    if (moved > 0) {
+        spinlock_acquire(&lock->lk_spinlock);
+        lock->lk_waiters += moved;
+        spinlock_release(&lock->lk_spinlock);
+    }
+}
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
@@ -295,7 +503,12 @@ cv_wait(struct cv *cv, struct lock *lock)
     wchan_lock(cv->cv_wchan);
     lock_release(lock);
     wchan_sleep(cv->cv_wchan);
-    lock_acquire(lock); 
+
+    // cv_signal and cv_broadcast move us to the lock's wait channel,
+    // so we were woken by lock_release, which (for a FIFO lock) has
+    // already handed us the lock. This picks up the handoff, or
+    // competes for the lock as usual if there wasn't one.
+    lock_get(lock, __builtin_return_address(0));
 }
 
 void
@@ -305,8 +518,10 @@ cv_signal(struct cv *cv, struct lock *lock)
     KASSERT(cv != NULL);
     KASSERT(lock_do_i_hold(lock));
 
-    // The condition is now met, wake up the waiting thread
-    wchan_wakeone(cv->cv_wchan);
+    // The condition is now met. The waiter would only wake up to
+    // find we still hold the lock, so instead move it to the lock's
+    // wait channel; lock_release will hand it the lock.
+    cv_addwaiters(lock, wchan_transfer(cv->cv_wchan, lock->lk_wchan, false));
 }
 
 void
@@ -316,6 +531,204 @@ cv_broadcast(struct cv *cv, struct lock *lock)
     KASSERT(cv != NULL);
     KASSERT(lock_do_i_hold(lock));        
 
-    // The condition is now met, wake up all
-    wchan_wakeall(cv->cv_wchan);
+    // The condition is now met. Move all the waiters to the lock's
+    // wait channel rather than waking them to fight over the lock;
+    // each lock_release hands it to the next one in turn.
+    cv_addwaiters(lock, wchan_transfer(cv->cv_wchan, lock->lk_wchan, true));
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL) {
+                goto fail_name;
+        }
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL) {
+                goto fail_readwchan;
+        }
+        rw->rw_upgradewchan = wchan_create(rw->rw_name);
+        if (rw->rw_upgradewchan == NULL) {
+                goto fail_writewchan;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+        rw->rw_upgrader = NULL;
+
+        return rw;
+
+ fail_writewchan:
+        wchan_destroy(rw->rw_writewchan);
+ fail_readwchan:
+        wchan_destroy(rw->rw_readwchan);
+ fail_name:
+        kfree(rw->rw_name);
+        kfree(rw);
+        return NULL;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitingwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_upgradewchan);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        // stay out while anyone is writing or waiting to write
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0 ||
+               rw->rw_upgrader != NULL) {
+                wchan_lock(rw->rw_readwchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_readwchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+        rw->rw_readers--;
+        if (rw->rw_readers == 1 && rw->rw_upgrader != NULL) {
+                // the one reader left is waiting to upgrade
+                wchan_wakeone(rw->rw_upgradewchan);
+        }
+        else if (rw->rw_readers == 0 && rw->rw_waitingwriters > 0) {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+                wchan_lock(rw->rw_writewchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_writewchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        // writers first; readers only get in once no writer is waiting
+        if (rw->rw_waitingwriters > 0) {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        else {
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_upgrade(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+
+        if (rw->rw_upgrader != NULL) {
+                // two upgraders would wait for each other forever
+                spinlock_release(&rw->rw_lock);
+                return false;
+        }
+
+        // new readers are kept out while rw_upgrader is set
+        rw->rw_upgrader = curthread;
+        while (rw->rw_readers > 1) {
+                wchan_lock(rw->rw_upgradewchan);
+                spinlock_release(&rw->rw_lock);
+                wchan_sleep(rw->rw_upgradewchan);
+                spinlock_acquire(&rw->rw_lock);
+        }
+        rw->rw_upgrader = NULL;
+        rw->rw_readers = 0;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+
+        return true;
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+        rw->rw_readers = 1;
+        if (rw->rw_waitingwriters == 0) {
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        return rw->rw_writer == curthread;
 }
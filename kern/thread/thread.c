@@ -37,6 +37,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <clock.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -72,6 +73,9 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* CPUs numbered this or higher are out of use; see thread_setactivecpus. */
+static volatile unsigned steal_maxcpus = (unsigned)-1;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +115,70 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Get a kernel stack for THREAD.
+ *
+ * Stacks of exited threads are kept in a small per-cpu cache (see
+ * thread_stack_free) so that thread_fork doesn't have to go through
+ * kmalloc, and thus alloc_kpages, every time. A cached stack still
+ * has the guard band thread_checkstack_init put on it; a fresh one
+ * gets it here.
+ *
+ * Interrupts are off while we look at the cache, so we can't be
+ * preempted, or migrated to another cpu, halfway through.
+ */
+static
+int
+thread_stack_alloc(struct thread *thread)
+{
+	int spl;
+
+	KASSERT(thread->t_stack == NULL);
+
+	spl = splhigh();
+	if (curcpu->c_numstackcache > 0) {
+		curcpu->c_numstackcache--;
+		thread->t_stack =
+			curcpu->c_stackcache[curcpu->c_numstackcache];
+	}
+	splx(spl);
+
+	if (thread->t_stack != NULL) {
+		thread_checkstack(thread);
+		return 0;
+	}
+
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		return ENOMEM;
+	}
+	thread_checkstack_init(thread);
+	return 0;
+}
+
+/*
+ * Give back a kernel stack. Put it in the current cpu's cache if
+ * there's room; otherwise free it.
+ */
+static
+void
+thread_stack_free(void *stack)
+{
+	int spl;
+
+	spl = splhigh();
+	if (curcpu->c_numstackcache < CPU_STACKCACHE_SIZE) {
+		curcpu->c_stackcache[curcpu->c_numstackcache] = stack;
+		curcpu->c_numstackcache++;
+		stack = NULL;
+	}
+	splx(spl);
+
+	if (stack != NULL) {
+		kfree(stack);
+	}
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -143,6 +211,14 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_lastcpu = NULL;
+	thread->t_lastrun = 0;
+#if OPT_SCHEDSTAT
+	thread->t_readytime = 0;
+#endif
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -167,6 +243,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned level;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -180,11 +257,30 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_numstackcache = 0;
+	c->c_stealseed = hardware_number * 2654435761U + 1;
+	c->c_affinity_hits = 0;
+	c->c_migrations = 0;
+	c->c_parkthread = NULL;
+	c->c_tickless = false;
+	c->c_tickless_start = 0;
+#if OPT_SCHEDSTAT
+	schedstat_reset(&c->c_schedstat);
+#endif
+#if OPT_SPLSTAT
+	c->c_irqoff_start = 0;
+	c->c_irqoff_idle = 0;
+	c->c_irqoff_site = NULL;
+#endif
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		threadlist_init(&c->c_runqueue[level]);
+	}
 	spinlock_init(&c->c_runqueue_lock);
 
+	callout_wheel_init(&c->c_callouts);
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
@@ -250,7 +346,8 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		thread_checkstack(thread);
+		thread_stack_free(thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -289,6 +386,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned level;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +402,11 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		curcpu->c_runqueue[level].tl_count = 0;
+		curcpu->c_runqueue[level].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[level].tl_tail.tln_prev = NULL;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -388,8 +489,8 @@ thread_bootstrap(void)
  * and curcpu should already be initialized.
  *
  * Other than clearing thread_start_cpus() to continue, we don't need
- * to do anything. The startup thread can just exit; we only need it
- * to be able to get into thread_switch() properly.
+ * to do anything. The startup thread stays around as the cpu's park
+ * thread (see thread_park) and otherwise never runs again.
  */
 void
 cpu_hatch(unsigned software_number)
@@ -402,8 +503,11 @@ cpu_hatch(unsigned software_number)
 
 	kprintf("cpu%u: %s\n", software_number, cpu_identify());
 
+	curcpu->c_parkthread = curthread;
 	V(cpu_startup_sem);
-	thread_exit();
+	while (1) {
+		thread_yield();
+	}
 }
 
 /*
@@ -426,18 +530,345 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations.
+ *
+ * Each cpu has one run queue per priority level. Threads are added at
+ * the tail of the queue for their current priority and taken from the
+ * head of the highest-priority nonempty queue. The caller must hold
+ * the cpu's runqueue lock.
+ */
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+}
+
+/*
+ * Return the highest priority level with a thread waiting on it, or
+ * SCHED_NLEVELS if the run queue is empty.
+ */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		if (!threadlist_isempty(&c->c_runqueue[level])) {
+			break;
+		}
+	}
+	return level;
+}
+
+static
+bool
+runqueue_isempty(struct cpu *c)
+{
+	return runqueue_toplevel(c) == SCHED_NLEVELS;
+}
+
+/*
+ * Count the threads waiting to run. This is also used without the
+ * lock to size up other cpus; the answer is then only a hint.
+ */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned level, count;
+
+	count = 0;
+	for (level = 0; level < SCHED_NLEVELS; level++) {
+		count += c->c_runqueue[level].tl_count;
+	}
+	return count;
+}
+
+/*
+ * Remove the thread that should run next.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned level;
+
+	level = runqueue_toplevel(c);
+	if (level == SCHED_NLEVELS) {
+		return NULL;
+	}
+	return threadlist_remhead(&c->c_runqueue[level]);
+}
+
+/*
+ * Check if thread T probably still has its working set in cpu C's
+ * cache.
+ */
+static
+bool
+thread_iscachehot(struct cpu *c, struct thread *t)
+{
+	return t->t_lastcpu == c &&
+		c->c_hardclocks - t->t_lastrun < SCHED_CACHEHOT_HARDCLOCKS;
+}
+
+/*
+ * Remove the thread that would run last. This is the one to give
+ * away when migrating. Threads that ran on this cpu very recently
+ * are passed over in favor of ones whose cache state is already
+ * gone; if there are none of those, a cache-hot thread is taken only
+ * if TAKEHOT is set.
+ *
+ * Ordinarily, the cpu's current thread will not appear on its run
+ * queue. However, it can under the following circumstances:
+ *   - it went to sleep;
+ *   - the processor became idle, so it remained curthread;
+ *   - it was reawakened, so it was put on the run queue;
+ *   - and the processor hasn't fully unidled yet, so all these
+ *     things are still true.
+ *
+ * The idle processor is still running on that thread's stack, so
+ * migrating it would be a disaster. Skip it.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c, bool takehot)
+{
+	struct thread *t, *hot;
+	unsigned level, hotlevel;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	hot = NULL;
+	hotlevel = 0;
+	for (level = SCHED_NLEVELS; level-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[level]) {
+			if (t == c->c_curthread) {
+				continue;
+			}
+			if (thread_iscachehot(c, t)) {
+				if (hot == NULL) {
+					hot = t;
+					hotlevel = level;
+				}
+				continue;
+			}
+			threadlist_remove(&c->c_runqueue[level], t);
+			return t;
+		}
+	}
+	if (takehot && hot != NULL) {
+		threadlist_remove(&c->c_runqueue[hotlevel], hot);
+		return hot;
+	}
+	return NULL;
+}
+
+/*
+ * Work stealing.
+ *
+ * Instead of busy cpus pushing work away, cpus that are short of work
+ * pull it from others. The victim is chosen by looking at two random
+ * other cpus and taking the one with the longer run queue (the "power
+ * of two choices"), which gets close to picking the most loaded cpu
+ * without having to look at all of them. We take the thread from the
+ * tail of the victim's queue, which is the one it would run last.
+ */
+
+/*
+ * Per-cpu xorshift generator. Good enough for picking victims, and
+ * unlike random() safe to call from the idle loop.
+ */
+static
+uint32_t
+steal_random(void)
+{
+	uint32_t x;
+
+	x = curcpu->c_stealseed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	curcpu->c_stealseed = x;
+	return x;
+}
+
+static
+struct cpu *
+steal_pickvictim(void)
+{
+	struct cpu *a, *b;
+	unsigned numcpus, me;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 2) {
+		return NULL;
+	}
+	me = curcpu->c_number;
+
+	a = cpuarray_get(&allcpus,
+			 (me + 1 + steal_random() % (numcpus - 1)) % numcpus);
+	b = cpuarray_get(&allcpus,
+			 (me + 1 + steal_random() % (numcpus - 1)) % numcpus);
+
+	/* Unlocked peeks; see runqueue_count. */
+	return runqueue_count(a) >= runqueue_count(b) ? a : b;
+}
+
+/*
+ * Try to take a thread from another cpu, provided that cpu has at
+ * least MINLOAD threads waiting. The thread is returned (already
+ * assigned to the current cpu) rather than queued, so the caller can
+ * run it or queue it as it sees fit. Cache-hot threads are only taken
+ * if we'd otherwise go idle, i.e. when MINLOAD is 1.
+ *
+ * Must be called without holding our own runqueue lock: two cpus
+ * stealing from each other would otherwise deadlock.
+ */
+static
+struct thread *
+thread_steal(unsigned minload)
+{
+	struct cpu *victim;
+	struct thread *t;
+
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_number >= steal_maxcpus) {
+		return NULL;
+	}
+
+	victim = steal_pickvictim();
+	if (victim == NULL || runqueue_count(victim) < minload) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = NULL;
+	if (runqueue_count(victim) >= minload) {
+		t = runqueue_remtail(victim, minload == 1);
+	}
+	if (t != NULL) {
+		t->t_cpu = curcpu->c_self;
+		curcpu->c_migrations++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return t;
+}
+
+/*
+ * Pick an idle cpu other than LASTCPU for a woken thread, preferring
+ * the one with the fewest threads waiting. Returns NULL if none are
+ * idle. The scan starts at a random cpu so simultaneous wakeups don't
+ * all pile onto the same one. Reads are unlocked and only hints.
+ */
+static
+struct cpu *
+thread_pickidlecpu(struct cpu *lastcpu)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus, start, count, bestcount;
+
+	numcpus = cpuarray_num(&allcpus);
+	start = steal_random() % numcpus;
+	best = NULL;
+	bestcount = 0;
+	for (i = 0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, (start + i) % numcpus);
+		if (c == lastcpu || c->c_number >= steal_maxcpus ||
+		    !c->c_isidle) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (best == NULL || count < bestcount) {
+			best = c;
+			bestcount = count;
+		}
+	}
+	return best;
+}
+
+/*
+ * Pick a cpu for a thread whose cpu has been taken out of use by
+ * thread_setactivecpus: an idle one if there is one, otherwise the
+ * active cpu with the fewest threads waiting. Hints only, as above.
+ */
+static
+struct cpu *
+thread_pickactivecpu(void)
+{
+	struct cpu *c, *best;
+	unsigned i, numactive, count, bestcount;
+
+	best = thread_pickidlecpu(NULL);
+	if (best != NULL) {
+		return best;
+	}
+
+	numactive = cpuarray_num(&allcpus);
+	if (numactive > steal_maxcpus) {
+		numactive = steal_maxcpus;
+	}
+	bestcount = 0;
+	for (i = 0; i < numactive; i++) {
+		c = cpuarray_get(&allcpus, i);
+		count = runqueue_count(c);
+		if (best == NULL || count < bestcount) {
+			best = c;
+			bestcount = count;
+		}
+	}
+	return best;
+}
+
+/*
+ * Check if cpu C has been taken out of use and should run nothing but
+ * its park thread. The boot cpu has none, but is never out of use.
+ */
+static
+bool
+thread_cpuinactive(struct cpu *c)
+{
+	return c->c_number >= steal_maxcpus && c->c_parkthread != NULL;
+}
+
 /*
  * Make a thread runnable.
  *
  * targetcpu might be curcpu; it might not be, too. 
+ *
+ * If we don't already have the lock (that is, for wakeups and new
+ * threads rather than yields), this is also where we decide which cpu
+ * the thread should run on. It goes back to the cpu it last ran on if
+ * that cpu is idle or lightly loaded, since its cache may still be
+ * warm; otherwise to an idle cpu if there is one. It never goes to a
+ * cpu that is out of use (see thread_setactivecpus), unless that
+ * cpu is still on its stack; thread_park moves it along from there.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
-	struct cpu *targetcpu;
+	struct cpu *targetcpu, *newcpu;
 	bool isidle;
 
+#if OPT_SCHEDSTAT
+	/* Start the run queue wait clock. */
+	target->t_readytime = schedstat_now();
+#endif
+
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
@@ -447,10 +878,38 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+
+		/*
+		 * Don't move the thread if its old cpu is idle and
+		 * still running on its stack; see runqueue_remtail.
+		 * Once that's ruled out with the old cpu locked, the
+		 * thread is on no cpu's stack and no list, so it's
+		 * safe to drop the lock before taking the new one.
+		 */
+		newcpu = NULL;
+		if (target != targetcpu->c_curthread &&
+		    thread_cpuinactive(targetcpu)) {
+			newcpu = thread_pickactivecpu();
+		}
+		else if (target != targetcpu->c_curthread &&
+			 !targetcpu->c_isidle &&
+			 runqueue_count(targetcpu) > SCHED_AFFINITY_LOAD) {
+			newcpu = thread_pickidlecpu(targetcpu);
+		}
+		if (newcpu != NULL) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = newcpu;
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+			curcpu->c_migrations++;
+		}
+		else if (target->t_lastcpu == targetcpu) {
+			curcpu->c_affinity_hits++;
+		}
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,12 +917,56 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (hardclock_anytickless()) {
+		/*
+		 * The thread has to wait here. Idle cpus used to
+		 * find it by trying to steal on every hardclock, but
+		 * tickless ones won't look until they're woken.
+		 */
+		newcpu = thread_pickidlecpu(targetcpu);
+		if (newcpu != NULL) {
+			ipi_send(newcpu, IPI_UNIDLE);
+		}
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Parking a cpu that is out of use.
+ *
+ * Such a cpu must not run anything, but it can't give away the thread
+ * whose stack it is on, and idling would leave it on that stack. So
+ * when its current thread switches out, the cpu switches to its park
+ * thread instead of anything queued; once on that thread's stack, it
+ * hands every queued thread to an active cpu and idles there. Called
+ * from the idle loop in thread_switch with our run queue locked;
+ * returns the thread to switch to, or NULL to idle.
+ */
+static
+struct thread *
+thread_park(struct thread *cur)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (cur != curcpu->c_parkthread) {
+		return curcpu->c_parkthread;
+	}
+
+	/* thread_make_runnable sends them elsewhere */
+	while (thread_cpuinactive(curcpu) &&
+	       (t = runqueue_remtail(curcpu, true)) != NULL) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		thread_make_runnable(t, false);
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+	}
+	return NULL;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -472,7 +975,8 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  *
  * The new thread is created in the process P. If P is null, the
  * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * as the caller, unless the scheduler intervenes first (as it does if
+ * that CPU is out of use).
  */
 int
 thread_fork(const char *name,
@@ -493,12 +997,11 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
+	result = thread_stack_alloc(newthread);
+	if (result) {
 		thread_destroy(newthread);
-		return ENOMEM;
+		return result;
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -549,6 +1052,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
 	int spl;
+#if OPT_SCHEDSTAT
+	uint64_t start, now, idlestart, idled;
+#endif
+#if OPT_SPLSTAT
+	uint64_t irqidlestart;
+#endif
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
@@ -567,14 +1076,28 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		return;
 	}
 
+#if OPT_SCHEDSTAT
+	start = schedstat_now();
+	idled = 0;
+#endif
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* Remember where and when we ran, for cache affinity. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastrun = curcpu->c_hardclocks;
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. Not for
+	 * a cpu that is out of use, which must get off this thread, or
+	 * for its park thread, which yields to go idle.
+	 */
+	if (newstate == S_READY && runqueue_isempty(curcpu) &&
+	    !thread_cpuinactive(curcpu) && cur != curcpu->c_parkthread) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -585,10 +1108,22 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		/* the park thread is only ever picked by thread_park */
+		if (cur != curcpu->c_parkthread) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		/*
+		 * Blocking before the quantum runs out marks the
+		 * thread as interactive or I/O-bound; boost it so it
+		 * gets the cpu back quickly when it wakes up.
+		 */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -629,18 +1164,80 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	/*
+	 * If our own run queue is empty, try to steal a thread from
+	 * another cpu before idling. This is retried each time the
+	 * idle loop wakes up: at every hardclock, or, if hardclocks
+	 * are being skipped (see hardclock_idle), when the next
+	 * callout is due or thread_make_runnable kicks us. Our own
+	 * run queue is unlocked while stealing; see thread_steal().
+	 * A cpu that is out of use neither steals nor runs what it
+	 * has; see thread_park().
+	 */
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (thread_cpuinactive(curcpu)) {
+			next = thread_park(cur);
+		}
+		else {
+			next = runqueue_remhead(curcpu);
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal(1);
+			if (next == NULL) {
+#if OPT_SCHEDSTAT
+				idlestart = schedstat_now();
+#endif
+#if OPT_SPLSTAT
+				irqidlestart = splstat_now();
+#endif
+				hardclock_idle();
+				cpu_idle();
+				hardclock_unidle();
+#if OPT_SPLSTAT
+				/* waiting for an interrupt doesn't hold one up */
+				splstat_idle(irqidlestart);
+#endif
+#if OPT_SCHEDSTAT
+				if (idlestart != 0) {
+					now = schedstat_now();
+					schedstat_record(
+					    &curcpu->c_schedstat.ss_idle,
+					    now - idlestart);
+					idled += now - idlestart;
+				}
+#endif
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+#if OPT_SCHEDSTAT
+	/*
+	 * Preemption happens from thread_tick, in the hardclock
+	 * interrupt; any other switch is the thread's own doing.
+	 */
+	if (newstate == S_READY && cur->t_in_interrupt) {
+		curcpu->c_schedstat.ss_involuntary++;
+	}
+	else if (newstate != S_ZOMBIE) {
+		curcpu->c_schedstat.ss_voluntary++;
+	}
+	if (start != 0) {
+		now = schedstat_now();
+		schedstat_record(&curcpu->c_schedstat.ss_switch,
+				 now - start - idled);
+		if (next->t_readytime != 0) {
+			schedstat_record(&curcpu->c_schedstat.ss_rqwait,
+					 now - next->t_readytime);
+		}
+	}
+#endif
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -820,27 +1417,95 @@ thread_yield(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Scheduler.
+ * Quantum accounting.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is called from hardclock() on every tick. The current thread
+ * is preempted when it has used up its quantum, in which case it is
+ * also demoted one level, or as soon as a thread of strictly higher
+ * priority is waiting, in which case it keeps the rest of its
+ * quantum for next time.
  */
-
 void
-schedule(void)
+thread_tick(void)
 {
+	struct thread *cur;
+	bool preempt;
+	int spl;
+
+	spl = splhigh();
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If we're idle, curthread is whatever last went to sleep
+	 * here; don't charge it for the idle loop.
 	 */
+	if (curcpu->c_isidle) {
+		splx(spl);
+		return;
+	}
+
+	cur = curthread;
+	KASSERT(cur->t_quantum > 0);
+	cur->t_quantum--;
+	if (cur->t_quantum == 0) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+		/* Don't bother switching if nothing else is waiting. */
+		preempt = runqueue_count(curcpu) > 0;
+	}
+	else {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		preempt = runqueue_toplevel(curcpu) < cur->t_priority;
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+	if (thread_cpuinactive(curcpu) && cur != curcpu->c_parkthread) {
+		/* out of use; go and hand it over (see thread_park) */
+		preempt = true;
+	}
+
+	splx(spl);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * Scheduler.
+ *
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queue: every waiting thread is promoted one priority
+ * level, so threads demoted to the bottom by cpu-bound phases cannot
+ * be starved indefinitely by a stream of higher-priority work.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned level;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	/* Go top down so each thread moves up only one level. */
+	for (level = 1; level < SCHED_NLEVELS; level++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[level]))
+		       != NULL) {
+			t->t_priority = level - 1;
+			t->t_quantum = SCHED_QUANTUM(level - 1);
+			threadlist_addtail(&curcpu->c_runqueue[level - 1], t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * This is also called periodically from hardclock(). Most load
+ * balancing happens when a cpu runs out of work and steals some from
+ * the idle loop in thread_switch. That never happens to a cpu that is
+ * busy but has a short run queue, so here we check whether a peer's
+ * queue is noticeably longer than ours and pull one thread if so.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -849,112 +1514,115 @@ schedule(void)
  * something that needs to be tuned and probably is workload-specific.
  *
  * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
+ * System/161 does not (yet) model such cache effects, we'll be fairly
  * aggressive.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
+	unsigned my_count;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	my_count = runqueue_count(curcpu);
+	t = thread_steal(my_count + 2);
+	if (t == NULL) {
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
+	runqueue_add(curcpu, t);
 	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
+/*
+ * CPUs N and up stop taking work at once. Whatever they are running
+ * or have queued moves to the others at their next hardclock at the
+ * latest, when the running thread is preempted and they park.
+ */
+void
+thread_setactivecpus(unsigned n)
+{
+	KASSERT(n >= 1);
+	steal_maxcpus = n;
+}
+
+bool
+thread_isrunning(const struct thread *t)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+		/* An idle cpu's c_curthread is asleep. */
+		if (c->c_curthread == t && !c->c_isidle) {
+			return true;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	}
+	return false;
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+/*
+ * Print per-cpu scheduler statistics. The counters are updated
+ * without locking by their own cpus, so this is only a snapshot.
+ */
+void
+thread_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+#if OPT_SCHEDSTAT
+	struct schedstat **stats;
+#endif
+
+	numcpus = cpuarray_num(&allcpus);
+	kprintf("cpu  affinity hits  migrations\n");
+	for (i = 0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u  %13u  %10u\n", c->c_number,
+			c->c_affinity_hits, c->c_migrations);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_SCHEDSTAT
+	stats = kmalloc(numcpus * sizeof(*stats));
+	if (stats == NULL) {
+		kprintf("schedstat: Out of memory\n");
+		return;
+	}
+	for (i = 0; i < numcpus; i++) {
+		stats[i] = &cpuarray_get(&allcpus, i)->c_schedstat;
 	}
+	schedstat_print(stats, numcpus);
+	kfree(stats);
+#endif
+}
+
+/*
+ * Clear the statistics printed by thread_printstats. Like the updates,
+ * this isn't synchronized, so a count in flight may survive it.
+ */
+void
+thread_resetstats(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		c->c_affinity_hits = 0;
+		c->c_migrations = 0;
+#if OPT_SCHEDSTAT
+		schedstat_reset(&c->c_schedstat);
+#endif
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1090,6 +1758,52 @@ wchan_wakeall(struct wchan *wc)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake up one thread sleeping on a wait channel, and return it.
+ */
+struct thread *
+wchan_handoff(struct wchan *wc)
+{
+	struct thread *target;
+
+	spinlock_acquire(&wc->wc_lock);
+	target = threadlist_remhead(&wc->wc_threads);
+	spinlock_release(&wc->wc_lock);
+
+	if (target != NULL) {
+		thread_make_runnable(target, false);
+	}
+	return target;
+}
+
+/*
+ * Move one or all threads sleeping on FROM over to TO.
+ */
+unsigned
+wchan_transfer(struct wchan *from, struct wchan *to, bool all)
+{
+	struct thread *target;
+	unsigned count;
+
+	KASSERT(from != to);
+
+	count = 0;
+	spinlock_acquire(&from->wc_lock);
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		count++;
+		if (!all) {
+			break;
+		}
+	}
+	spinlock_release(&to->wc_lock);
+	spinlock_release(&from->wc_lock);
+
+	return count;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
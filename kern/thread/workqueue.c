@@ -0,0 +1,334 @@
+/*
+ * Work queues. See workqueue.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <workqueue.h>
+
+/*
+ * One cpu's share of a workqueue. wqc_queued and wqc_done count work
+ * items put on the queue and finished, so a flush can wait for the
+ * items queued before it without tracking them individually. They're
+ * compared by difference, so wrapping around is fine.
+ */
+struct wq_cpu {
+	struct spinlock wqc_lock;
+	struct work *wqc_head;		/* Queue of pending work */
+	struct work *wqc_tail;
+	struct wchan *wqc_wchan;	/* Worker sleeps here */
+	struct wchan *wqc_flushwchan;	/* Flushers sleep here */
+	unsigned wqc_queued;
+	unsigned wqc_done;
+	unsigned wqc_flushers;		/* Threads waiting in flush */
+	bool wqc_idle;			/* Worker asleep on wqc_wchan */
+	bool wqc_exiting;		/* Worker should exit */
+	bool wqc_exited;		/* Worker has exited */
+};
+
+struct workqueue {
+	char *wq_name;
+	unsigned wq_ncpus;
+	struct wq_cpu *wq_cpus;
+};
+
+struct workqueue *sys_workqueue;
+
+static void workqueue_timeout(void *data);
+
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_wq = NULL;
+	callout_init(&w->w_callout, workqueue_timeout, w);
+	w->w_pending = 0;
+}
+
+void
+work_cleanup(struct work *w)
+{
+	KASSERT(w->w_pending == 0);
+	callout_cleanup(&w->w_callout);
+}
+
+/*
+ * Put W, already marked pending, on this cpu's queue of WQ.
+ */
+static
+void
+workqueue_enqueue(struct workqueue *wq, struct work *w)
+{
+	struct wq_cpu *wqc;
+
+	wqc = &wq->wq_cpus[curcpu->c_number % wq->wq_ncpus];
+
+	spinlock_acquire(&wqc->wqc_lock);
+	KASSERT(!wqc->wqc_exiting);
+	w->w_next = NULL;
+	if (wqc->wqc_tail == NULL) {
+		wqc->wqc_head = w;
+	}
+	else {
+		wqc->wqc_tail->w_next = w;
+	}
+	wqc->wqc_tail = w;
+	wqc->wqc_queued++;
+	if (wqc->wqc_idle) {
+		wqc->wqc_idle = false;
+		wchan_wakeone(wqc->wqc_wchan);
+	}
+	spinlock_release(&wqc->wqc_lock);
+}
+
+bool
+workqueue_submit(struct workqueue *wq, struct work *w)
+{
+	if (!atomic_cas(&w->w_pending, 0, 1)) {
+		return false;
+	}
+	workqueue_enqueue(wq, w);
+	return true;
+}
+
+/*
+ * Timer function for delayed work. Runs from hardclock.
+ */
+static
+void
+workqueue_timeout(void *data)
+{
+	struct work *w = data;
+
+	workqueue_enqueue(w->w_wq, w);
+}
+
+bool
+workqueue_submit_delayed(struct workqueue *wq, struct work *w,
+			 unsigned ticks)
+{
+	if (!atomic_cas(&w->w_pending, 0, 1)) {
+		return false;
+	}
+	if (ticks == 0) {
+		workqueue_enqueue(wq, w);
+		return true;
+	}
+	w->w_wq = wq;
+	callout_schedule(&w->w_callout, ticks);
+	return true;
+}
+
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct wq_cpu *wqc = data1;
+	struct work *w;
+	void (*func)(void *);
+	void *arg;
+
+	(void)data2;
+
+	spinlock_acquire(&wqc->wqc_lock);
+	while (1) {
+		w = wqc->wqc_head;
+		if (w == NULL) {
+			if (wqc->wqc_exiting) {
+				break;
+			}
+			wqc->wqc_idle = true;
+			wchan_lock(wqc->wqc_wchan);
+			spinlock_release(&wqc->wqc_lock);
+			wchan_sleep(wqc->wqc_wchan);
+			spinlock_acquire(&wqc->wqc_lock);
+			continue;
+		}
+
+		wqc->wqc_head = w->w_next;
+		if (wqc->wqc_head == NULL) {
+			wqc->wqc_tail = NULL;
+		}
+		spinlock_release(&wqc->wqc_lock);
+
+		/* W may be resubmitted or freed as soon as it's not pending. */
+		func = w->w_func;
+		arg = w->w_arg;
+		w->w_next = NULL;
+		w->w_pending = 0;
+		func(arg);
+
+		spinlock_acquire(&wqc->wqc_lock);
+		wqc->wqc_done++;
+		if (wqc->wqc_flushers > 0) {
+			wchan_wakeall(wqc->wqc_flushwchan);
+		}
+	}
+
+	wqc->wqc_exited = true;
+	wchan_wakeall(wqc->wqc_flushwchan);
+	spinlock_release(&wqc->wqc_lock);
+	thread_exit();
+}
+
+/*
+ * Wait until WQC has finished everything queued on it so far, or (if
+ * WAITEXIT) until its worker has exited.
+ */
+static
+void
+workqueue_wait(struct wq_cpu *wqc, bool waitexit)
+{
+	unsigned target;
+
+	spinlock_acquire(&wqc->wqc_lock);
+	target = wqc->wqc_queued;
+	wqc->wqc_flushers++;
+	while (waitexit ? !wqc->wqc_exited :
+	       (int)(target - wqc->wqc_done) > 0) {
+		wchan_lock(wqc->wqc_flushwchan);
+		spinlock_release(&wqc->wqc_lock);
+		wchan_sleep(wqc->wqc_flushwchan);
+		spinlock_acquire(&wqc->wqc_lock);
+	}
+	wqc->wqc_flushers--;
+	spinlock_release(&wqc->wqc_lock);
+}
+
+void
+workqueue_flush(struct workqueue *wq)
+{
+	unsigned i;
+
+	for (i = 0; i < wq->wq_ncpus; i++) {
+		workqueue_wait(&wq->wq_cpus[i], false);
+	}
+}
+
+static
+void
+workqueue_cleanupcpu(struct wq_cpu *wqc)
+{
+	KASSERT(wqc->wqc_head == NULL);
+	if (wqc->wqc_flushwchan != NULL) {
+		wchan_destroy(wqc->wqc_flushwchan);
+	}
+	if (wqc->wqc_wchan != NULL) {
+		wchan_destroy(wqc->wqc_wchan);
+	}
+	spinlock_cleanup(&wqc->wqc_lock);
+}
+
+struct workqueue *
+workqueue_create(const char *name)
+{
+	struct workqueue *wq;
+	struct wq_cpu *wqc;
+	char namebuf[32];
+	unsigned i, n;
+	int result;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_name = kstrdup(name);
+	if (wq->wq_name == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_ncpus = thread_numcpus();
+	wq->wq_cpus = kmalloc(wq->wq_ncpus * sizeof(struct wq_cpu));
+	if (wq->wq_cpus == NULL) {
+		kfree(wq->wq_name);
+		kfree(wq);
+		return NULL;
+	}
+
+	for (i = 0; i < wq->wq_ncpus; i++) {
+		wqc = &wq->wq_cpus[i];
+		spinlock_init(&wqc->wqc_lock);
+		wqc->wqc_head = wqc->wqc_tail = NULL;
+		wqc->wqc_wchan = wchan_create(wq->wq_name);
+		wqc->wqc_flushwchan = wchan_create(wq->wq_name);
+		wqc->wqc_queued = wqc->wqc_done = 0;
+		wqc->wqc_flushers = 0;
+		wqc->wqc_idle = false;
+		wqc->wqc_exiting = false;
+		wqc->wqc_exited = false;
+		if (wqc->wqc_wchan == NULL || wqc->wqc_flushwchan == NULL) {
+			i++;
+			goto fail;
+		}
+	}
+
+	for (n = 0; n < wq->wq_ncpus; n++) {
+		snprintf(namebuf, sizeof(namebuf), "%s/%u", wq->wq_name, n);
+		result = thread_fork(namebuf, NULL, workqueue_worker,
+				     &wq->wq_cpus[n], 0);
+		if (result) {
+			/* Stop the ones we started. */
+			while (n > 0) {
+				n--;
+				wqc = &wq->wq_cpus[n];
+				spinlock_acquire(&wqc->wqc_lock);
+				wqc->wqc_exiting = true;
+				wchan_wakeone(wqc->wqc_wchan);
+				spinlock_release(&wqc->wqc_lock);
+				workqueue_wait(wqc, true);
+			}
+			goto fail;
+		}
+	}
+
+	return wq;
+
+ fail:
+	for (; i > 0; i--) {
+		workqueue_cleanupcpu(&wq->wq_cpus[i-1]);
+	}
+	kfree(wq->wq_cpus);
+	kfree(wq->wq_name);
+	kfree(wq);
+	return NULL;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	struct wq_cpu *wqc;
+	unsigned i;
+
+	for (i = 0; i < wq->wq_ncpus; i++) {
+		wqc = &wq->wq_cpus[i];
+		spinlock_acquire(&wqc->wqc_lock);
+		wqc->wqc_exiting = true;
+		wchan_wakeone(wqc->wqc_wchan);
+		spinlock_release(&wqc->wqc_lock);
+	}
+	for (i = 0; i < wq->wq_ncpus; i++) {
+		wqc = &wq->wq_cpus[i];
+		workqueue_wait(wqc, true);
+		workqueue_cleanupcpu(wqc);
+	}
+	kfree(wq->wq_cpus);
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+void
+workqueue_bootstrap(void)
+{
+	sys_workqueue = workqueue_create("syswq");
+	if (sys_workqueue == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+}
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -77,23 +78,47 @@ vnode_cleanup(struct vnode *vn)
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
+ *
+ * The refcount is updated atomically, without vfs_biglock. The caller
+ * either already has a reference, or (like a filesystem's vnode
+ * lookup) holds vfs_biglock, so the vnode can't be in the middle of
+ * being reclaimed.
  */
 void
 vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
+	atomic_inc(&vn->vn_refcount);
+}
 
-	vn->vn_refcount++;
+/*
+ * Drop a reference unless it's the last one. Returns false, without
+ * changing anything, if it is.
+ */
+static
+bool
+vnode_decref_notlast(struct vnode *vn)
+{
+	int old;
 
-	vfs_biglock_release();
+	do {
+		old = vn->vn_refcount;
+		KASSERT(old>0);
+		if (old == 1) {
+			return false;
+		}
+	} while (!atomic_cas(&vn->vn_refcount, old, old-1));
+
+	return true;
 }
 
 /*
  * Decrement refcount.
  * Called by VOP_DECREF.
  * Calls VOP_RECLAIM if the refcount hits zero.
+ *
+ * Only the final decrement takes vfs_biglock.
  */
 void
 vnode_decref(struct vnode *vn)
@@ -102,13 +127,18 @@ vnode_decref(struct vnode *vn)
 
 	KASSERT(vn != NULL);
 
+	if (vnode_decref_notlast(vn)) {
+		return;
+	}
+
 	vfs_biglock_acquire();
 
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
+	/*
+	 * Someone may have looked the vnode up again before we got
+	 * the biglock. Once we hold it with the count at 1, nobody
+	 * else can get a reference.
+	 */
+	if (!vnode_decref_notlast(vn)) {
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
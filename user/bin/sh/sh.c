@@ -45,6 +45,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <err.h>
+#include <spawn.h>
 
 #ifdef HOST
 #include "hostcompat.h"
@@ -154,39 +155,44 @@ dowait(pid_t pid)
 #ifdef WNOHANG
 /*
  * dowaitpoll
- * like dowait, but uses WNOHANG. returns true if we got something.
+ * like dowait, but for any child, and uses WNOHANG. returns the pid
+ * of the child we got, or 0 if none has exited.
  */
 static
-int
-dowaitpoll(pid_t pid)
+pid_t
+dowaitpoll(void)
 {
 	int status;
 	pid_t result;
-	result = waitpid(pid, &status, WNOHANG);
+	result = waitpid(WAIT_ANY, &status, WNOHANG);
 	if (result<0) {
-		warn("pid %d", pid);
+		/* ECHILD just means there's nothing running */
+		if (errno != ECHILD) {
+			warn("waitpid");
+		}
+		return 0;
 	}
 	else if (result!=0) {
-		printf("pid %d: ", pid);
+		printf("pid %d: ", result);
 		printstatus(status);
 		printf("\n");
-		return 1;
 	}
-	return 0;
+	return result;
 }
 
 /*
  * waitpoll
- * poll all background jobs for having exited.
+ * collect every background job that has exited, one waitpid each.
  */
 static
 void
 waitpoll(void)
 {
 	int i;
-	for (i=0; i < MAXBG; i++) {
-		if (bgpids[i] != 0) {
-			if (dowaitpoll(bgpids[i])) {
+	pid_t pid;
+	while ((pid = dowaitpoll()) != 0) {
+		for (i=0; i < MAXBG; i++) {
+			if (bgpids[i] == pid) {
 				bgpids[i] = 0;
 			}
 		}
@@ -354,26 +360,16 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	/*
+	 * The child only execs, so don't fork: spawn makes the new
+	 * process and loads the program in one step, without copying
+	 * (or even borrowing) our address space. If the program can't
+	 * be loaded the child exits with status 127.
+	 */
+	pid = spawn(args[0], args, NULL);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(255);
 	}
 
 	/* parent */
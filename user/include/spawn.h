@@ -0,0 +1,38 @@
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+/*
+ * Starting a program in a new process in one step, without copying
+ * the caller's address space as fork does.
+ *
+ * spawn runs PATH with arguments ARGV in a new child of the caller,
+ * first doing the file actions in FA (which may be NULL), and returns
+ * the child's pid. On error it returns -1 with errno set, and no
+ * process is made. If the program can be opened but not loaded, the
+ * child exits with status 127.
+ *
+ * File actions are set up with spawn_file_actions_init and then
+ * spawn_file_actions_addclose / spawn_file_actions_adddup2, which
+ * return 0, or an error code if FA is full.
+ */
+
+#include <kern/spawn.h>
+
+struct spawn_file_actions {
+	int sfa_num;
+	struct spawn_action sfa_actions[SPAWN_ACTIONS_MAX];
+};
+
+void spawn_file_actions_init(struct spawn_file_actions *fa);
+int spawn_file_actions_addclose(struct spawn_file_actions *fa, int fd);
+int spawn_file_actions_adddup2(struct spawn_file_actions *fa,
+			       int fd, int newfd);
+
+/* The system call: takes the actions as an array. */
+pid_t __spawn(const char *path, char *const *argv,
+	      const struct spawn_action *actions, int nactions);
+
+pid_t spawn(const char *path, char *const *argv,
+	    const struct spawn_file_actions *fa);	/* calls __spawn */
+
+#endif /* _SPAWN_H_ */
@@ -0,0 +1,38 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/*
+ * Mutexes and condition variables for user-level threads (see
+ * threadfork in unistd.h).
+ *
+ * These work in user mode with atomic operations and only enter the
+ * kernel, through __futex_wait and __futex_wake, when a thread has to
+ * sleep or has somebody to wake up. An uncontended lock and unlock
+ * make no system calls at all.
+ *
+ * Either initialize with MUTEX_INITIALIZER / COND_INITIALIZER or call
+ * mutex_init / cond_init. There is nothing to destroy.
+ */
+
+struct mutex {
+	volatile int m_state;	/* 0 free, 1 held, 2 held with waiters */
+};
+
+struct cond {
+	volatile int c_seq;	/* bumped by every signal/broadcast */
+};
+
+#define MUTEX_INITIALIZER	{ 0 }
+#define COND_INITIALIZER	{ 0 }
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);	/* returns nonzero if it got it */
+void mutex_unlock(struct mutex *m);
+
+void cond_init(struct cond *c);
+void cond_wait(struct cond *c, struct mutex *m);
+void cond_signal(struct cond *c);
+void cond_broadcast(struct cond *c);
+
+#endif /* _THREAD_H_ */
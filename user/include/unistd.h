@@ -146,6 +146,7 @@ int link(const char *oldfile, const char *newfile);
 int chdir(const char *path);
 
 /* Optional. */
+pid_t vfork(void);
 void *sbrk(int change);
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
@@ -153,7 +154,14 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
+/* __spawn - see spawn.h */
+int __thread_create(void (*entry)(void *), void *arg, void *stack);
+__DEAD void __thread_exit(int code);
+int __thread_join(int tid, int *status);
+int __futex_wait(volatile int *addr, int val);
+int __futex_wake(volatile int *addr, int count);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -163,5 +171,7 @@ int __getcwd(char *buf, size_t buflen);
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void *), void *arg);	/* calls __thread_create */
+int threadjoin(int tid, int *status);		/* calls __thread_join */
 
 #endif /* _UNISTD_H_ */
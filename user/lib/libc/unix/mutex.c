@@ -0,0 +1,158 @@
+/*
+ * User-level mutexes and condition variables. See thread.h.
+ *
+ * The mutex is the usual three-state futex lock: 0 is free, 1 is
+ * held, and 2 is held with (possibly) someone asleep on it. Only a
+ * locker that saw the lock busy sets 2, and only an unlock that finds
+ * 2 makes a system call to wake somebody.
+ */
+
+#include <unistd.h>
+#include <thread.h>
+
+/* How many times to retry a busy lock before going to sleep on it. */
+#define MUTEX_SPINS	100
+
+/* Largest wake count: everybody. */
+#define WAKE_ALL	0x7fffffff
+
+/*
+ * If *P is OLDVAL, set it to NEWVAL. Returns the value *P had.
+ */
+static
+int
+atomic_cas(volatile int *p, int oldval, int newval)
+{
+	int x;
+	int y;
+
+	do {
+		y = 0;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != oldval) fail */
+			"move %1, %4;"		/*   y = newval */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (p), "r" (oldval), "r" (newval)
+			: "memory");
+	} while (x == oldval && y == 0);
+	return x;
+}
+
+/*
+ * Store NEWVAL in *P and return the value it had.
+ */
+static
+int
+atomic_swap(volatile int *p, int newval)
+{
+	int x;
+
+	do {
+		x = *p;
+	} while (atomic_cas(p, x, newval) != x);
+	return x;
+}
+
+static
+void
+atomic_inc(volatile int *p)
+{
+	int x;
+
+	do {
+		x = *p;
+	} while (atomic_cas(p, x, x + 1) != x);
+}
+
+void
+mutex_init(struct mutex *m)
+{
+	m->m_state = 0;
+}
+
+/*
+ * Sleep until we get the lock, leaving it marked as contended, since
+ * we can't tell whether anyone else is still asleep on it.
+ */
+static
+void
+mutex_lock_contended(struct mutex *m)
+{
+	while (atomic_swap(&m->m_state, 2) != 0) {
+		__futex_wait(&m->m_state, 2);
+	}
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	int i, c;
+
+	for (i=0; i<MUTEX_SPINS; i++) {
+		c = atomic_cas(&m->m_state, 0, 1);
+		if (c == 0) {
+			return;
+		}
+		if (c == 2) {
+			/* others are already asleep; don't jump the queue */
+			break;
+		}
+	}
+	mutex_lock_contended(m);
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+	return atomic_cas(&m->m_state, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if (atomic_swap(&m->m_state, 0) == 2) {
+		__futex_wake(&m->m_state, 1);
+	}
+}
+
+void
+cond_init(struct cond *c)
+{
+	c->c_seq = 0;
+}
+
+/*
+ * Sample the sequence number before letting go of the mutex, so a
+ * signal sent after that makes __futex_wait return right away.
+ */
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq;
+
+	seq = c->c_seq;
+	mutex_unlock(m);
+	__futex_wait(&c->c_seq, seq);
+	mutex_lock_contended(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+	atomic_inc(&c->c_seq);
+	__futex_wake(&c->c_seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	atomic_inc(&c->c_seq);
+	__futex_wake(&c->c_seq, WAKE_ALL);
+}
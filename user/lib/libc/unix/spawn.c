@@ -0,0 +1,52 @@
+/*
+ * spawn and its file actions, on top of the __spawn system call.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+
+void
+spawn_file_actions_init(struct spawn_file_actions *fa)
+{
+	fa->sfa_num = 0;
+}
+
+static
+int
+spawn_file_actions_add(struct spawn_file_actions *fa, int op,
+		       int fd, int newfd)
+{
+	struct spawn_action *a;
+
+	if (fa->sfa_num >= SPAWN_ACTIONS_MAX) {
+		return ENOMEM;
+	}
+	a = &fa->sfa_actions[fa->sfa_num++];
+	a->sa_op = op;
+	a->sa_fd = fd;
+	a->sa_newfd = newfd;
+	return 0;
+}
+
+int
+spawn_file_actions_addclose(struct spawn_file_actions *fa, int fd)
+{
+	return spawn_file_actions_add(fa, SPAWN_CLOSE, fd, -1);
+}
+
+int
+spawn_file_actions_adddup2(struct spawn_file_actions *fa, int fd, int newfd)
+{
+	return spawn_file_actions_add(fa, SPAWN_DUP2, fd, newfd);
+}
+
+pid_t
+spawn(const char *path, char *const *argv,
+      const struct spawn_file_actions *fa)
+{
+	if (fa == NULL) {
+		return __spawn(path, argv, NULL, 0);
+	}
+	return __spawn(path, argv, fa->sfa_actions, fa->sfa_num);
+}
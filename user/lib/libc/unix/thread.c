@@ -0,0 +1,106 @@
+/*
+ * User-level threads, on top of the __thread_create, __thread_exit
+ * and __thread_join system calls.
+ *
+ * The kernel leaves the new thread's stack to us. There's no sbrk to
+ * get memory from, so stacks come out of a fixed pool and a stack is
+ * handed back when its thread is joined; threads that are never
+ * joined keep theirs.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <thread.h>
+
+#define THREAD_MAX		16
+#define THREAD_STACKSIZE	(16*1024)
+
+struct threadslot {
+	int ts_inuse;
+	int ts_tid;
+	void (*ts_func)(void *);
+	void *ts_arg;
+};
+
+static struct mutex thread_slotlock = MUTEX_INITIALIZER;
+static struct threadslot thread_slots[THREAD_MAX];
+static char thread_stacks[THREAD_MAX][THREAD_STACKSIZE]
+	__attribute__((__aligned__(8)));
+
+/*
+ * Where new threads start: run the function, and exit if it returns.
+ */
+static
+void
+thread_start(void *data)
+{
+	struct threadslot *ts = data;
+
+	ts->ts_func(ts->ts_arg);
+	__thread_exit(0);
+}
+
+/*
+ * Start a thread running FUNC(ARG). Returns its thread id, or -1
+ * with errno set.
+ */
+int
+threadfork(void (*func)(void *), void *arg)
+{
+	struct threadslot *ts;
+	int i, tid;
+
+	mutex_lock(&thread_slotlock);
+	for (i=0; i<THREAD_MAX; i++) {
+		if (!thread_slots[i].ts_inuse) {
+			break;
+		}
+	}
+	if (i == THREAD_MAX) {
+		mutex_unlock(&thread_slotlock);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ts = &thread_slots[i];
+	ts->ts_inuse = 1;
+	ts->ts_tid = -1;
+	ts->ts_func = func;
+	ts->ts_arg = arg;
+
+	/* hold the lock across this so a racing join can find the tid */
+	tid = __thread_create(thread_start, ts,
+			      &thread_stacks[i][THREAD_STACKSIZE]);
+	if (tid < 0) {
+		ts->ts_inuse = 0;
+		mutex_unlock(&thread_slotlock);
+		return -1;
+	}
+	ts->ts_tid = tid;
+	mutex_unlock(&thread_slotlock);
+	return tid;
+}
+
+/*
+ * Wait for thread TID to exit and collect its exit code.
+ */
+int
+threadjoin(int tid, int *status)
+{
+	int i;
+
+	if (__thread_join(tid, status) < 0) {
+		return -1;
+	}
+
+	/* it's gone, so its stack can be reused */
+	mutex_lock(&thread_slotlock);
+	for (i=0; i<THREAD_MAX; i++) {
+		if (thread_slots[i].ts_inuse && thread_slots[i].ts_tid == tid) {
+			thread_slots[i].ts_inuse = 0;
+			break;
+		}
+	}
+	mutex_unlock(&thread_slotlock);
+	return 0;
+}
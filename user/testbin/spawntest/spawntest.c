@@ -0,0 +1,173 @@
+/*
+ * Test spawn.
+ *
+ * We spawn ourselves with an argument saying what the child should
+ * check: that it got its arguments, that a descriptor closed by a
+ * file action is closed, that one made by dup2 from stdout works,
+ * and that one made from stdin is still not writable. Then we
+ * check that errors (a missing program, an action on a descriptor
+ * that isn't open) come back from spawn, and that a batch of spawned
+ * children all get reaped.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <spawn.h>
+
+#define PROGNAME	"/testbin/spawntest"
+#define NCHILDREN	50
+
+static
+int
+reap(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status)) {
+		errx(1, "pid %d: didn't exit normally", pid);
+	}
+	return WEXITSTATUS(status);
+}
+
+/*
+ * Spawn ourselves with MODE and return the child's exit code.
+ */
+static
+int
+run(const char *mode, const struct spawn_file_actions *fa)
+{
+	char *args[4];
+	pid_t pid;
+
+	args[0] = (char *)PROGNAME;
+	args[1] = (char *)mode;
+	args[2] = (char *)"spawntest-arg";
+	args[3] = NULL;
+	pid = spawn(PROGNAME, args, fa);
+	if (pid < 0) {
+		err(1, "spawn %s", mode);
+	}
+	return reap(pid);
+}
+
+/*
+ * What the child does. Exits 0 if all is well.
+ */
+static
+int
+child(int argc, char **argv)
+{
+	const char *mode = argv[1];
+	static const char msg[] = "spawntest: child writing to fd 5\n";
+
+	if (argc != 3 || strcmp(argv[0], PROGNAME) ||
+	    strcmp(argv[2], "spawntest-arg")) {
+		return 1;
+	}
+	if (!strcmp(mode, "args")) {
+		return 0;
+	}
+	if (!strcmp(mode, "closed")) {
+		if (write(1, "x", 1) >= 0 || errno != EBADF) {
+			return 2;
+		}
+		return 0;
+	}
+	if (!strcmp(mode, "dup")) {
+		if (write(5, msg, sizeof(msg)-1) != sizeof(msg)-1) {
+			return 3;
+		}
+		return 0;
+	}
+	if (!strcmp(mode, "rdonly")) {
+		if (write(5, "x", 1) >= 0) {
+			return 5;
+		}
+		return 0;
+	}
+	return 4;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct spawn_file_actions fa;
+	char *args[2];
+	pid_t pid;
+	int i, code;
+
+	if (argc > 1) {
+		return child(argc, argv);
+	}
+
+	printf("spawntest: argument test...\n");
+	code = run("args", NULL);
+	if (code != 0) {
+		errx(1, "args child exited with %d", code);
+	}
+
+	printf("spawntest: close test...\n");
+	spawn_file_actions_init(&fa);
+	spawn_file_actions_addclose(&fa, 1);
+	code = run("closed", &fa);
+	if (code != 0) {
+		errx(1, "closed child exited with %d", code);
+	}
+
+	printf("spawntest: dup2 test...\n");
+	spawn_file_actions_init(&fa);
+	spawn_file_actions_adddup2(&fa, 1, 5);
+	code = run("dup", &fa);
+	if (code != 0) {
+		errx(1, "dup child exited with %d", code);
+	}
+
+	spawn_file_actions_init(&fa);
+	spawn_file_actions_adddup2(&fa, 0, 5);
+	code = run("rdonly", &fa);
+	if (code != 0) {
+		errx(1, "rdonly child exited with %d", code);
+	}
+
+	printf("spawntest: error tests...\n");
+	args[0] = (char *)"nonexistent";
+	args[1] = NULL;
+	if (spawn("/testbin/nonexistent", args, NULL) >= 0) {
+		errx(1, "spawn of a missing program succeeded");
+	}
+	if (errno != ENOENT) {
+		err(1, "spawn of a missing program: expected ENOENT, got");
+	}
+	spawn_file_actions_init(&fa);
+	spawn_file_actions_addclose(&fa, 9);
+	args[0] = (char *)"true";
+	if (spawn("/bin/true", args, &fa) >= 0) {
+		errx(1, "close of an unopened descriptor succeeded");
+	}
+	if (errno != EBADF) {
+		err(1, "close of an unopened descriptor: expected EBADF, got");
+	}
+
+	printf("spawntest: %d children...\n", NCHILDREN);
+	for (i=0; i<NCHILDREN; i++) {
+		pid = spawn("/bin/true", args, NULL);
+		if (pid < 0) {
+			err(1, "spawn");
+		}
+		code = reap(pid);
+		if (code != 0) {
+			errx(1, "/bin/true exited with %d", code);
+		}
+	}
+
+	printf("spawntest: passed\n");
+	return 0;
+}
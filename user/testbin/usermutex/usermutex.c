@@ -0,0 +1,147 @@
+/*
+ * Test the libc mutexes and condition variables (thread.h).
+ *
+ * First, several threads bump a shared counter under a mutex, with a
+ * read-modify-write that is easily torn if the mutex doesn't work.
+ * Then producers and consumers pass items through a small bounded
+ * buffer guarded by a mutex and two condition variables, and we check
+ * that every item came out exactly once.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+#include <thread.h>
+
+#define NTHREADS	4
+#define NLOOPS		20000
+
+#define NITEMS		2000
+#define BUFSIZE		4
+
+static struct mutex countlock = MUTEX_INITIALIZER;
+static volatile int count;
+
+static struct mutex buflock = MUTEX_INITIALIZER;
+static struct cond notfull = COND_INITIALIZER;
+static struct cond notempty = COND_INITIALIZER;
+static int buf[BUFSIZE];
+static int bufhead, buftail, bufcount;
+static int seen[NTHREADS/2 * NITEMS];
+
+static
+void
+counter(void *junk)
+{
+	struct timespec nap = { 0, 100000 };
+	int i, x;
+
+	(void)junk;
+
+	for (i=0; i<NLOOPS; i++) {
+		mutex_lock(&countlock);
+		x = count;
+		if (i % 1000 == 0) {
+			/* give anyone who shouldn't be in here a chance */
+			nanosleep(&nap, NULL);
+		}
+		count = x + 1;
+		mutex_unlock(&countlock);
+	}
+}
+
+static
+void
+producer(void *arg)
+{
+	int base = (int)arg;
+	int i;
+
+	for (i=0; i<NITEMS; i++) {
+		mutex_lock(&buflock);
+		while (bufcount == BUFSIZE) {
+			cond_wait(&notfull, &buflock);
+		}
+		buf[buftail] = base + i;
+		buftail = (buftail + 1) % BUFSIZE;
+		bufcount++;
+		cond_signal(&notempty);
+		mutex_unlock(&buflock);
+	}
+}
+
+static
+void
+consumer(void *junk)
+{
+	int i, item;
+
+	(void)junk;
+
+	for (i=0; i<NITEMS; i++) {
+		mutex_lock(&buflock);
+		while (bufcount == 0) {
+			cond_wait(&notempty, &buflock);
+		}
+		item = buf[bufhead];
+		bufhead = (bufhead + 1) % BUFSIZE;
+		bufcount--;
+		seen[item]++;
+		cond_signal(&notfull);
+		mutex_unlock(&buflock);
+	}
+}
+
+static
+void
+startall(int *tids, int n, void (*func)(void *), int argstep)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		tids[i] = threadfork(func, (void *)(i * argstep));
+		if (tids[i] < 0) {
+			err(1, "threadfork");
+		}
+	}
+}
+
+static
+void
+joinall(int *tids, int n)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (threadjoin(tids[i], NULL) < 0) {
+			err(1, "threadjoin");
+		}
+	}
+}
+
+int
+main(void)
+{
+	int tids[NTHREADS];
+	int i;
+
+	printf("usermutex: counter test...\n");
+	startall(tids, NTHREADS, counter, 0);
+	joinall(tids, NTHREADS);
+	if (count != NTHREADS * NLOOPS) {
+		errx(1, "count is %d, expected %d", count, NTHREADS * NLOOPS);
+	}
+
+	printf("usermutex: producer/consumer test...\n");
+	startall(tids, NTHREADS/2, producer, NITEMS);
+	startall(tids + NTHREADS/2, NTHREADS/2, consumer, 0);
+	joinall(tids, NTHREADS);
+	for (i=0; i<NTHREADS/2 * NITEMS; i++) {
+		if (seen[i] != 1) {
+			errx(1, "item %d seen %d times", i, seen[i]);
+		}
+	}
+
+	printf("usermutex: passed\n");
+	return 0;
+}
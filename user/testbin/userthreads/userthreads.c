@@ -35,14 +35,10 @@
  * This won't do much of anything unless you implement user-level
  * threads.
  *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * Threads are created with threadfork() and waited for with
+ * threadjoin(); see unistd.h. A thread that returns from the function
+ * it started in exits. Since the process (and so every thread in it)
+ * goes away when main returns, the parent joins its children first.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -51,6 +47,7 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
 
 #define NTHREADS  3
 #define MAX       1<<25
@@ -61,22 +58,30 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+void ThreadRunner(void *);
+void BladeRunner(void *);
 
 int
 main(int argc, char *argv[])
 {
     int i;
+    int tids[NTHREADS];
 
     (void)argc;
     (void)argv;
 
     for (i=0; i<NTHREADS; i++) {
 	if (i)
-	    threadfork(ThreadRunner);
+	    tids[i] = threadfork(ThreadRunner, NULL);
         else
-	    threadfork(BladeRunner);
+	    tids[i] = threadfork(BladeRunner, NULL);
+	if (tids[i] < 0)
+	    err(1, "threadfork");
+    }
+
+    for (i=0; i<NTHREADS; i++) {
+	if (threadjoin(tids[i], NULL) < 0)
+	    err(1, "threadjoin");
     }
 
     printf("Parent has left.\n");
@@ -89,8 +94,10 @@ main(int argc, char *argv[])
 */
 
 void
-BladeRunner()
+BladeRunner(void *junk)
 {
+    (void)junk;
+
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
@@ -99,8 +106,10 @@ BladeRunner()
 }
 
 void
-ThreadRunner()
+ThreadRunner(void *junk)
 {
+    (void)junk;
+
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");
@@ -0,0 +1,95 @@
+/*
+ * Test vfork.
+ *
+ * First, the child writes to a global and exits; since it runs on
+ * our address space and we don't run again until it's done, we must
+ * see the write as soon as vfork returns. Then a child execs
+ * /bin/true, to check that exec gives the address space back. Last,
+ * a batch of children exit with different codes, to check they all
+ * get reaped with the right status.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define NCHILDREN	100
+
+static volatile int shared;
+
+static
+int
+reap(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status)) {
+		errx(1, "pid %d: didn't exit normally", pid);
+	}
+	return WEXITSTATUS(status);
+}
+
+int
+main(void)
+{
+	char *args[2];
+	pid_t pid;
+	int i, code;
+
+	printf("vforktest: borrowing test...\n");
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		shared = 1234;
+		_exit(7);
+	}
+	if (shared != 1234) {
+		errx(1, "child's write not seen: shared is %d", shared);
+	}
+	code = reap(pid);
+	if (code != 7) {
+		errx(1, "child exited with %d, expected 7", code);
+	}
+
+	printf("vforktest: exec test...\n");
+	args[0] = (char *)"true";
+	args[1] = NULL;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv("/bin/true", args);
+		_exit(255);
+	}
+	code = reap(pid);
+	if (code != 0) {
+		errx(1, "/bin/true exited with %d", code);
+	}
+
+	printf("vforktest: %d children...\n", NCHILDREN);
+	for (i=0; i<NCHILDREN; i++) {
+		pid = vfork();
+		if (pid < 0) {
+			err(1, "vfork");
+		}
+		if (pid == 0) {
+			_exit(i);
+		}
+		code = reap(pid);
+		if (code != i) {
+			errx(1, "child %d exited with %d", i, code);
+		}
+	}
+
+	printf("vforktest: passed\n");
+	return 0;
+}
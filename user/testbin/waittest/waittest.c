@@ -0,0 +1,97 @@
+/*
+ * Test waitpid with WNOHANG and with pid -1 (any child).
+ *
+ * First a batch of children exit with different codes and are
+ * collected with waitpid(-1); each must turn up exactly once, with
+ * its own code, and after that there must be no children left.
+ * Then a child that sleeps for a second must not be reported
+ * by WNOHANG, but must be by a plain waitpid afterwards.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCHILDREN	20
+
+static pid_t pids[NCHILDREN];
+
+static
+pid_t
+dofork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	return pid;
+}
+
+int
+main(void)
+{
+	struct timespec nap = { 1, 0 };
+	pid_t pid;
+	int i, status;
+
+	printf("waittest: wait-for-any test...\n");
+	for (i=0; i<NCHILDREN; i++) {
+		pid = dofork();
+		if (pid == 0) {
+			_exit(i);
+		}
+		pids[i] = pid;
+	}
+	for (i=0; i<NCHILDREN; i++) {
+		pid = waitpid(WAIT_ANY, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status)) {
+			errx(1, "pid %d: didn't exit normally", pid);
+		}
+		status = WEXITSTATUS(status);
+		if (status < 0 || status >= NCHILDREN || pids[status] != pid) {
+			errx(1, "pid %d: unexpected exit code %d", pid, status);
+		}
+		/* so a second report of the same child is caught */
+		pids[status] = 0;
+	}
+	if (waitpid(WAIT_ANY, &status, 0) >= 0 || errno != ECHILD) {
+		errx(1, "waitpid with no children didn't fail with ECHILD");
+	}
+	if (waitpid(WAIT_ANY, &status, WNOHANG) >= 0 || errno != ECHILD) {
+		errx(1, "WNOHANG with no children didn't fail with ECHILD");
+	}
+
+	printf("waittest: WNOHANG test...\n");
+	pid = dofork();
+	if (pid == 0) {
+		nanosleep(&nap, NULL);
+		_exit(3);
+	}
+	if (waitpid(pid, &status, WNOHANG) != 0) {
+		errx(1, "WNOHANG reported a child that's still running");
+	}
+	if (waitpid(WAIT_ANY, &status, WNOHANG) != 0) {
+		errx(1, "WNOHANG reported some child that's still running");
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 3) {
+		errx(1, "child exited with status %d, expected 3", status);
+	}
+
+	if (waitpid(WAIT_ANY, &status, 12345) >= 0 || errno != EINVAL) {
+		errx(1, "waitpid with bad options didn't fail with EINVAL");
+	}
+
+	printf("waittest: passed\n");
+	return 0;
+}